@@ -4,6 +4,8 @@
 #include <string>
 #include <memory>
 #include <chrono>
+#include <cmath>
+#include <vector>
 
 #include <glad/glad.h>
 #define GLFW_INCLUDE_NONE
@@ -20,6 +22,11 @@
 #include "light.hpp"
 #include "framebuffer.hpp"
 #include "skybox.hpp"
+#include "benchmark.hpp"
+#include "uniform_blocks.hpp"
+#include "shadow_cache.hpp"
+#include "scene_streamer.hpp"
+#include "scene_cache.hpp"
 
 class QuickGLApplication {
 public: 
@@ -28,6 +35,9 @@ public:
 	}
 
 	~QuickGLApplication() {
+		// both delete GL objects, so they go while the context is alive
+		streamer = nullptr;
+		hiz = nullptr;
 		glfwDestroyWindow(window);
 		glfwTerminate();
 	}
@@ -71,12 +81,22 @@ public:
 		auto shadow_map = std::make_shared<Texture>(depth_frame_buf.handle, shadow_width, shadow_height);
 		// A framebuffer object however is not complete without a color buffer so we need to explicitly tell OpenGL we're not going to render any color data
 		depth_frame_buf.unbind();
+		ShadowCache shadow_cache(shadow_width, shadow_height);
+		shadow_cache.enabled = shadow_caching;
 
 		auto mat_earth = std::make_shared<PhongMaterial>(shader, tex_earth, light, shadow_map);
 		auto mat_moon = std::make_shared<PhongMaterial>(shader, tex_moon, light, shadow_map);
 		auto mat_simple = std::make_shared<SimpleColorMaterial>(glm::vec3(1.0, 1.0, 1.0));
 
-		gltf_scene->init(shader, light, shadow_map);
+		// a streamed scene is initialized by poll() in the frame loop
+		if (cache != nullptr) {
+			cache->upload(*gltf_scene, shader, light, shadow_map);
+			cache = nullptr;
+		} else if (streamer == nullptr) {
+			gltf_scene->init(shader, light, shadow_map);
+		}
+		gltf_scene->set_lod_bias(true, lod_bias);
+		GLTFRenderQueue::getInstance()->depth_prepass_material = mat_simple;
 
 		Sphere sph = Sphere(1.0f);
 		Sphere sph2 = Sphere(0.1f);
@@ -102,8 +122,50 @@ public:
 
 		glEnable(GL_DEPTH_TEST);
 
-		while (!glfwWindowShouldClose(window))
+		PassUniformBuffer pass_uniforms;
+
+		// the static shadow view comes first, so it can be left out of build
+		enum { VIEW_SHADOW_STATIC, VIEW_SHADOW_DYNAMIC, VIEW_MAIN, VIEW_COUNT };
+		GLTFView views[VIEW_COUNT];
+		views[VIEW_SHADOW_STATIC].name = "static shadow";
+		views[VIEW_SHADOW_STATIC].override_material = mat_simple;
+		views[VIEW_SHADOW_STATIC].layer = CL_STATIC;
+		views[VIEW_SHADOW_DYNAMIC].name = "dynamic shadow";
+		views[VIEW_SHADOW_DYNAMIC].override_material = mat_simple;
+		views[VIEW_SHADOW_DYNAMIC].layer = CL_DYNAMIC;
+		// shadow casters get by with coarser LODs than what the camera sees
+		for (GLTFView* view : { &views[VIEW_SHADOW_STATIC], &views[VIEW_SHADOW_DYNAMIC] }) {
+			view->viewport_height = static_cast<float>(shadow_height);
+			view->lod_bias = 1.0f;
+		}
+		views[VIEW_MAIN].name = "main";
+		gltf_scene->frustum_culling = frustum_culling;
+		// the main pass is culled against its own depth of the frame before
+		hiz = std::make_unique<HiZCuller>();
+		hiz->enabled = occlusion_culling;
+		views[VIEW_MAIN].occlusion = hiz.get();
+		// the main pass culls back faces, so its meshlets can be cone culled;
+		// shadow passes draw both faces of every caster
+		views[VIEW_MAIN].cull_back_faces = true;
+		views[VIEW_MAIN].meshlet_culling = true;
+
+		if (benchmark.enabled()) {
+			glfwSwapInterval(0);
+		}
+		// --lod-sweep runs the benchmark once per bias, NAN for LODs off
+		std::vector<float> sweep_biases;
+		if (lod_sweep && benchmark.enabled()) {
+			sweep_biases = { NAN, 0.0f, 1.0f, 2.0f, 3.0f };
+			gltf_scene->set_lod_bias(false, .0f);
+		}
+		size_t sweep_run = 0;
+		bool load_reported = false;
+
+		while (!glfwWindowShouldClose(window) && !benchmark.done())
 		{
+			benchmark.begin_frame();
+			// until the streamed geometry is uploaded only the skybox is drawn
+			bool scene_ready = streamer == nullptr || streamer->poll(shader, light, shadow_map, stream_budget_ms);
 			auto now_time = std::chrono::high_resolution_clock::now();
 			float t = std::chrono::duration_cast<std::chrono::duration<float>>(now_time - start_time).count();
 
@@ -126,34 +188,163 @@ public:
 			// 	* glm::rotate(glm::mat4(1.0f), 3.0f * t / (2.0f * 3.14f), glm::vec3(.0f, 1.0f, .0f));
 			// light_sph.model = glm::translate(glm::mat4(1.0f), light->position);
 
-			glDepthMask(GL_TRUE);
-			glViewport(0, 0, shadow_width, shadow_height);
-			depth_frame_buf.bind();
-			glClear(GL_DEPTH_BUFFER_BIT);
-			glCullFace(GL_FRONT);
-			// draw
-			// sph.draw(light->light_cam, mat_simple);
-			// sph2.draw(light->light_cam, mat_simple);
-			gltf_scene->render(light->light_cam, mat_simple);
-			GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-			if (status != GL_FRAMEBUFFER_COMPLETE) {
-				std::cerr << "fb error: " << status << std::endl;
+			if (scene_ready) {
+				gltf_scene->update();
+			}
+			glm::mat4 light_vp = light->light_cam.project() * light->light_cam.view();
+			bool static_dirty = shadow_cache.static_dirty(light_vp, gltf_scene->static_version);
+			bool dynamic_casters = gltf_scene->dynamic_items() > 0;
+
+			views[VIEW_SHADOW_STATIC].cam = light->light_cam;
+			views[VIEW_SHADOW_DYNAMIC].cam = light->light_cam;
+			views[VIEW_MAIN].cam = camera;
+			views[VIEW_MAIN].viewport_height = static_cast<float>(viewport_height);
+			if (scene_ready && static_dirty) {
+				gltf_scene->build(views, VIEW_COUNT);
+			} else if (scene_ready) {
+				gltf_scene->build(views + VIEW_SHADOW_DYNAMIC, VIEW_COUNT - VIEW_SHADOW_DYNAMIC);
+			}
+
+			// the shadow map only changes with the static layer or dynamic casters
+			if (scene_ready && (static_dirty || dynamic_casters)) {
+				GLState::getInstance()->depth_mask(GL_TRUE);
+				glViewport(0, 0, shadow_width, shadow_height);
+				// draw
+				// sph.draw(mat_simple);
+				// sph2.draw(mat_simple);
+				pass_uniforms.update(light->light_cam, *light);
+				if (static_dirty) {
+					shadow_cache.static_layer.bind();
+					glClear(GL_DEPTH_BUFFER_BIT);
+					gltf_scene->render(views[VIEW_SHADOW_STATIC]);
+					shadow_cache.static_drawn(light_vp, gltf_scene->static_version);
+				}
+				shadow_cache.composite(depth_frame_buf.handle);
+				depth_frame_buf.bind();
+				if (dynamic_casters) {
+					gltf_scene->render(views[VIEW_SHADOW_DYNAMIC]);
+				}
+				GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+				if (status != GL_FRAMEBUFFER_COMPLETE) {
+					std::cerr << "fb error: " << status << std::endl;
+				}
+				glBindFramebuffer(GL_FRAMEBUFFER, 0); // unbind
 			}
-			glBindFramebuffer(GL_FRAMEBUFFER, 0); // unbind
 
 			glViewport(0, 0, viewport_width, viewport_height);
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-			glCullFace(GL_BACK);
-			// sph.draw(camera, mat_earth);
-			// sph2.draw(camera, mat_moon);
-			// light_sph.draw(light->light_cam, mat_simple);
+			// sph.draw(mat_earth);
+			// sph2.draw(mat_moon);
+			// light_sph.draw(mat_simple);
 			
-			skybox.draw(camera);
-			gltf_scene->render(camera);
+			pass_uniforms.update(camera, *light);
+			skybox.draw();
+			if (scene_ready) {
+				gltf_scene->render(views[VIEW_MAIN]);
+			}
+			hiz->capture(camera.project() * camera.view(), viewport_width, viewport_height);
+			benchmark.end_render();
 
 			glfwSwapBuffers(window);
 			glfwPollEvents(); 
+			GLTFRenderQueue::getInstance()->end_frame();
+			shadow_cache.end_frame();
+			benchmark.end_frame();
+
+			if (!load_reported) {
+				if (streamer == nullptr) {
+					std::cout << "load: first frame, fully loaded, after " << ms_since_load() << " ms" << std::endl;
+					load_reported = true;
+				} else {
+					streamer->first_frame();
+					if (streamer->done()) {
+						streamer->print_stats(std::cout);
+						load_reported = true;
+					}
+					// frames of a partly loaded scene are not measured
+					benchmark.restart();
+				}
+			}
+
+			if (benchmark.done() && sweep_run < sweep_biases.size()) {
+				float bias = sweep_biases[sweep_run];
+				std::cout << "lod bias " << (std::isnan(bias) ? "off" : std::to_string(bias)) << ": "
+					<< benchmark.ms_per_frame() << " ms/frame, "
+					<< GLTFRenderQueue::getInstance()->sorted_stats.triangles << " triangles last frame" << std::endl;
+				if (++sweep_run < sweep_biases.size()) {
+					bias = sweep_biases[sweep_run];
+					gltf_scene->set_lod_bias(!std::isnan(bias), std::isnan(bias) ? .0f : bias);
+					benchmark.restart();
+				}
+			}
 		}
+
+		if (benchmark.enabled()) {
+			benchmark.report(std::cout);
+			std::cout << "scene graph: " << gltf_scene->graph.last_updated << " world matrices updated last frame" << std::endl;
+			for (const GLTFView& view : views) {
+				view.print_stats(std::cout);
+			}
+			GLTFRenderQueue::getInstance()->print_stats(std::cout);
+			GLState::getInstance()->print_stats(std::cout);
+			ShaderProgram::print_stats(std::cout);
+			hiz->print_stats(std::cout);
+			if (gltf_scene->meshlet_culler != nullptr) {
+				gltf_scene->meshlet_culler->print_stats(std::cout);
+			}
+			shadow_cache.print_stats(std::cout);
+			gltf_scene->benchmark_bvh(camera, std::cout);
+			std::cout << "memory: ";
+			ProcessMemory::query().print(std::cout);
+			std::cout << std::endl;
+		}
+	}
+
+	void set_benchmark_frames(int frames) {
+		benchmark.frames = frames;
+	}
+
+	void set_frustum_culling(bool enable) {
+		frustum_culling = enable;
+	}
+
+	void set_occlusion_culling(bool enable) {
+		occlusion_culling = enable;
+	}
+
+	void set_shadow_caching(bool enable) {
+		shadow_caching = enable;
+	}
+
+	void set_lods(bool generate, float bias, bool sweep) {
+		generate_lods = generate;
+		lod_bias = bias;
+		lod_sweep = sweep;
+	}
+
+	void set_meshlets(bool generate) {
+		generate_meshlets = generate;
+	}
+
+	void set_geometry_optimization(bool optimize, bool quantize) {
+		optimize_geometry = optimize;
+		quantize_vertices = quantize;
+	}
+
+	void set_release_payloads(bool release) {
+		release_payloads = release;
+	}
+
+	// budget_ms of GL uploads per frame while streaming, or load before the
+	// first frame
+	void set_streaming(bool enable, double budget_ms) {
+		streaming = enable;
+		stream_budget_ms = budget_ms;
+	}
+
+	// load the scene's .qglc cache instead when it is up to date
+	void set_scene_cache(bool enable) {
+		use_cache = enable;
 	}
 
 	std::shared_ptr<ShaderProgram> create_shader_program(const char* vert_shader, const char* frag_shader) {
@@ -165,7 +356,38 @@ public:
 	}
 
 	void load_scene(const std::string &filename) {
-		gltf_scene = std::make_shared<GLTFScene>(filename);
+		load_start = std::chrono::high_resolution_clock::now();
+		gltf_scene = std::make_shared<GLTFScene>();
+		configure_scene(*gltf_scene);
+		if (use_cache) {
+			cache = std::make_unique<SceneCache>();
+			std::string err;
+			if (cache->open(SceneCache::path_for(filename), filename, SceneCache::flags_of(*gltf_scene), err)) {
+				cache->restore(*gltf_scene);
+				std::cout << "scene cache: restored " << SceneCache::path_for(filename) << " in " << ms_since_load() << " ms" << std::endl;
+				return;
+			}
+			std::cout << "scene cache: " << err << ", loading the glTF" << std::endl;
+			cache = nullptr;
+		}
+		if (streaming) {
+			streamer = std::make_unique<SceneStreamer>(gltf_scene, filename);
+		} else {
+			gltf_scene = std::make_shared<GLTFScene>(filename);
+			configure_scene(*gltf_scene);
+		}
+	}
+
+	void configure_scene(GLTFScene& scene) const {
+		scene.optimize_geometry = optimize_geometry;
+		scene.quantize_vertices = quantize_vertices;
+		scene.release_payloads = release_payloads;
+		scene.generate_lods = generate_lods;
+		scene.generate_meshlets = generate_meshlets;
+	}
+
+	double ms_since_load() const {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - load_start).count();
 	}
 
 	static void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
@@ -197,6 +419,22 @@ public:
 		} else if (key == GLFW_KEY_S && action == GLFW_PRESS) {
 			glm::vec3 delta = glm::vec3(.0f, .0f, 0.1f);
 			app->camera.pos += glm::transpose(glm::mat3(app->camera.view())) * delta;
+		} else if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+			auto* queue = GLTFRenderQueue::getInstance();
+			queue->opaque_order = static_cast<GLTFRenderQueue::OpaqueOrder>((queue->opaque_order + 1) % 3);
+			std::cout << "opaque order: " << GLTFRenderQueue::opaque_order_name(queue->opaque_order) << std::endl;
+		} else if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+			GLTFRenderQueue::getInstance()->print_stats(std::cout);
+			GLState::getInstance()->print_stats(std::cout);
+			ShaderProgram::print_stats(std::cout);
+			app->hiz->print_stats(std::cout);
+		} else if ((key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET) && action == GLFW_PRESS) {
+			app->lod_bias += key == GLFW_KEY_RIGHT_BRACKET ? 1.0f : -1.0f;
+			app->gltf_scene->set_lod_bias(true, app->lod_bias);
+			std::cout << "lod bias: " << app->lod_bias << std::endl;
+		} else if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+			app->hiz->enabled = !app->hiz->enabled;
+			std::cout << "hi-z culling: " << (app->hiz->enabled ? "on" : "off") << std::endl;
 		} else if (key == GLFW_KEY_ESCAPE) {
 			exit(0);
 		}
@@ -234,6 +472,12 @@ public:
 			app->old_cam = app->camera;
 		}
 
+		if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS) {
+			double x, y;
+			glfwGetCursorPos(window, &x, &y);
+			app->pick(x, y);
+		}
+
 		if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE) {
 			app->left_pressed = false;
 		}
@@ -244,6 +488,23 @@ public:
 		}
 	}
 
+	// casts a ray from the camera through the cursor and prints the hit node
+	void pick(double x, double y) {
+		glm::mat4 inv_vp = glm::inverse(camera.project() * camera.view());
+		glm::vec4 ndc(x / viewport_width * 2.0 - 1.0, 1.0 - y / viewport_height * 2.0, 1.0f, 1.0f);
+		glm::vec4 p = inv_vp * ndc;
+		glm::vec3 dir = glm::normalize(glm::vec3(p) / p.w - camera.pos);
+		float t;
+		int64_t item = gltf_scene->pick(camera.pos, dir, t);
+		if (item < 0) {
+			std::cout << "pick: nothing" << std::endl;
+			return;
+		}
+		uint32_t node = gltf_scene->items.node[item];
+		std::cout << "pick: node " << gltf_scene->model.nodes[gltf_scene->graph.node[node]].name
+			<< ", primitive " << gltf_scene->items.primitive[item] << ", distance " << t << std::endl;
+	}
+
 private:
 	GLFWwindow* window;
 	Camera camera;
@@ -253,6 +514,24 @@ private:
 	bool left_pressed = false, middle_pressed = false;
 	Camera old_cam;
 	double xpos, ypos;
+	FrameBenchmark benchmark;
+	bool frustum_culling = true;
+	bool occlusion_culling = true;
+	bool shadow_caching = true;
+	bool generate_lods = true;
+	float lod_bias = .0f;
+	bool lod_sweep = false;
+	bool generate_meshlets = true;
+	bool optimize_geometry = true;
+	bool quantize_vertices = true;
+	bool release_payloads = true;
+	bool streaming = true;
+	double stream_budget_ms = 2.0;
+	std::chrono::high_resolution_clock::time_point load_start;
+	std::unique_ptr<SceneStreamer> streamer;
+	bool use_cache = true;
+	std::unique_ptr<SceneCache> cache;
+	std::unique_ptr<HiZCuller> hiz;
 
 	void _init_glfw() {
 		if (!glfwInit()) {
@@ -302,10 +581,97 @@ private:
 int main(int argc, char **argv)
 {
 	std::string filename = "resource/forest_house/scene.gltf";
-	if (argc >= 2) {
-		filename = argv[1];
+	int bench_frames = 0;
+	bool frustum_culling = true;
+	bool occlusion_culling = true;
+	bool shadow_caching = true;
+	bool generate_lods = true;
+	float lod_bias = .0f;
+	bool lod_sweep = false;
+	bool generate_meshlets = true;
+	bool optimize_geometry = true;
+	bool quantize_vertices = true;
+	bool release_payloads = true;
+	bool load_bench = false;
+	bool streaming = true;
+	double stream_budget_ms = 2.0;
+	bool use_cache = true;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--bench" && i + 1 < argc) {
+			bench_frames = std::stoi(argv[++i]);
+		} else if (arg == "--threads" && i + 1 < argc) {
+			ThreadPool::requested_workers = std::max(1, std::stoi(argv[++i])) - 1;
+		} else if (arg == "--no-cull") {
+			frustum_culling = false;
+		} else if (arg == "--no-occlusion") {
+			occlusion_culling = false;
+		} else if (arg == "--no-shadow-cache") {
+			shadow_caching = false;
+		} else if (arg == "--no-lods") {
+			generate_lods = false;
+		} else if (arg == "--lod-bias" && i + 1 < argc) {
+			lod_bias = std::stof(argv[++i]);
+		} else if (arg == "--lod-sweep") {
+			lod_sweep = true;
+		} else if (arg == "--no-optimize") {
+			optimize_geometry = false;
+		} else if (arg == "--no-quantize") {
+			quantize_vertices = false;
+		} else if (arg == "--load-bench") {
+			load_bench = true;
+		} else if (arg == "--no-cache") {
+			use_cache = false;
+		} else if (arg == "--no-stream") {
+			streaming = false;
+		} else if (arg == "--stream-budget" && i + 1 < argc) {
+			stream_budget_ms = std::stod(argv[++i]);
+		} else if (arg == "--keep-payloads") {
+			release_payloads = false;
+		} else if (arg == "--no-meshlets") {
+			generate_meshlets = false;
+		} else if (arg == "--no-persistent") {
+			DynamicBuffer::allow_persistent = false;
+		} else if (arg == "--opaque-order" && i + 1 < argc) {
+			std::string order = argv[++i];
+			auto* queue = GLTFRenderQueue::getInstance();
+			if (order == "state") {
+				queue->opaque_order = GLTFRenderQueue::OO_STATE;
+			} else if (order == "front-to-back") {
+				queue->opaque_order = GLTFRenderQueue::OO_FRONT_TO_BACK;
+			} else if (order == "prepass") {
+				queue->opaque_order = GLTFRenderQueue::OO_DEPTH_PREPASS;
+			} else {
+				std::cerr << "unknown opaque order: " << order << std::endl;
+				return -1;
+			}
+		} else {
+			filename = arg;
+		}
+	}
+	if (load_bench) {
+		// needs no GL context, so it runs before the window opens
+		std::vector<std::string> scenes = {
+			"resource/forest_house/scene.gltf",
+			"resource/my/my.gltf",
+			"resource/my2/untitled.gltf",
+			"resource/fantasy_game_inn.glb",
+		};
+		benchmark_image_decoding(scenes, std::cout);
+		benchmark_scene_cache(scenes, SceneCache::flags_of(optimize_geometry, quantize_vertices, generate_lods, generate_meshlets), std::cout);
+		return 0;
 	}
 	QuickGLApplication app;
+	app.set_benchmark_frames(bench_frames);
+	app.set_frustum_culling(frustum_culling);
+	app.set_occlusion_culling(occlusion_culling);
+	app.set_shadow_caching(shadow_caching);
+	app.set_lods(generate_lods, lod_bias, lod_sweep);
+	app.set_meshlets(generate_meshlets);
+	app.set_geometry_optimization(optimize_geometry, quantize_vertices);
+	app.set_release_payloads(release_payloads);
+	app.set_streaming(streaming, stream_budget_ms);
+	app.set_scene_cache(use_cache);
 	app.load_scene(filename);
 	app.main_loop();
 	return 0;
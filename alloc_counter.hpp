@@ -0,0 +1,38 @@
+#pragma once
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Global heap allocation counter for the frame benchmark. The operator new
+// replacement is only compiled in with QUICKGL_COUNT_ALLOCS, and this header
+// must be included by exactly one translation unit.
+struct AllocCounter {
+#ifdef QUICKGL_COUNT_ALLOCS
+	static constexpr bool enabled = true;
+#else
+	static constexpr bool enabled = false;
+#endif
+	static inline std::atomic<size_t> count{ 0 };
+
+	static size_t allocations() {
+		return count.load(std::memory_order_relaxed);
+	}
+};
+
+#ifdef QUICKGL_COUNT_ALLOCS
+void* operator new(size_t size) {
+	AllocCounter::count.fetch_add(1, std::memory_order_relaxed);
+	if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+	std::free(ptr);
+}
+#endif
@@ -0,0 +1,123 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "alloc_counter.hpp"
+
+// average wall time of fn over repeats calls, after one untimed call
+template<typename F>
+double average_ms(int repeats, F&& fn) {
+	using clock = std::chrono::high_resolution_clock;
+	fn();
+	auto start = clock::now();
+	for (int i = 0; i < repeats; ++i) {
+		fn();
+	}
+	return std::chrono::duration<double, std::milli>(clock::now() - start).count() / std::max(1, repeats);
+}
+
+// resident set size of the process now and at its peak, in bytes; zero
+// where /proc is not available
+struct ProcessMemory {
+	size_t resident = 0;
+	size_t peak = 0;
+
+	static ProcessMemory query() {
+		ProcessMemory memory;
+#ifdef __linux__
+		if (FILE* status = std::fopen("/proc/self/status", "r")) {
+			char line[256];
+			while (std::fgets(line, sizeof(line), status)) {
+				size_t kib = 0;
+				if (std::sscanf(line, "VmRSS: %zu kB", &kib) == 1) {
+					memory.resident = kib * 1024;
+				} else if (std::sscanf(line, "VmHWM: %zu kB", &kib) == 1) {
+					memory.peak = kib * 1024;
+				}
+			}
+			std::fclose(status);
+		}
+#endif
+		return memory;
+	}
+
+	void print(std::ostream& os) const {
+		if (resident == 0) {
+			os << "rss unavailable";
+			return;
+		}
+		os << "rss " << resident / (1024 * 1024) << " MiB, peak " << peak / (1024 * 1024) << " MiB";
+	}
+};
+
+// Runs a fixed number of frames after a short warm-up and reports the
+// average frame time and the heap allocations made while rendering.
+struct FrameBenchmark {
+	using clock = std::chrono::high_resolution_clock;
+
+	int warmup_frames = 10;
+	int frames = 0;
+
+	bool enabled() const {
+		return frames > 0;
+	}
+
+	bool done() const {
+		return enabled() && frame >= warmup_frames + frames;
+	}
+
+	void begin_frame() {
+		frame_start = clock::now();
+		allocs_at_start = AllocCounter::allocations();
+	}
+
+	// call once the frame's GL commands are issued, before swapping buffers
+	void end_render() {
+		if (measuring()) {
+			render_allocs += AllocCounter::allocations() - allocs_at_start;
+		}
+	}
+
+	void end_frame() {
+		if (measuring()) {
+			total_ms += std::chrono::duration<double, std::milli>(clock::now() - frame_start).count();
+		}
+		frame += 1;
+	}
+
+	// starts over with a fresh warm-up, e.g. for the next configuration
+	void restart() {
+		frame = 0;
+		render_allocs = 0;
+		total_ms = 0.0;
+	}
+
+	double ms_per_frame() const {
+		return total_ms / std::max(1, frame - warmup_frames);
+	}
+
+	void report(std::ostream& os) const {
+		int measured = std::max(1, frame - warmup_frames);
+		os << "benchmark: " << measured << " frames, " << ms_per_frame() << " ms/frame" << std::endl;
+		if (AllocCounter::enabled) {
+			os << "heap allocations while rendering: " << render_allocs
+				<< " (" << static_cast<double>(render_allocs) / measured << " per frame)" << std::endl;
+		} else {
+			os << "heap allocations: not counted, configure with QUICKGL_COUNT_ALLOCS=ON" << std::endl;
+		}
+	}
+
+private:
+	bool measuring() const {
+		return frame >= warmup_frames;
+	}
+
+	int frame = 0;
+	clock::time_point frame_start;
+	size_t allocs_at_start = 0;
+	size_t render_allocs = 0;
+	double total_ms = 0.0;
+};
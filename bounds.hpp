@@ -0,0 +1,204 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QUICKGL_SSE 1
+#include <xmmintrin.h>
+#endif
+
+struct AABB {
+	glm::vec3 min = glm::vec3(FLT_MAX);
+	glm::vec3 max = glm::vec3(-FLT_MAX);
+
+	bool empty() const {
+		return min.x > max.x;
+	}
+
+	void expand(const glm::vec3& p) {
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+
+	void expand(const AABB& other) {
+		min = glm::min(min, other.min);
+		max = glm::max(max, other.max);
+	}
+
+	glm::vec3 center() const {
+		return (min + max) * 0.5f;
+	}
+
+	glm::vec3 extent() const {
+		return (max - min) * 0.5f;
+	}
+
+	float surface_area() const {
+		glm::vec3 d = max - min;
+		return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	// bounds of the transformed box (Arvo)
+	AABB transformed(const glm::mat4& m) const {
+		glm::vec3 c = glm::vec3(m * glm::vec4(center(), 1.0f));
+		glm::vec3 e = extent();
+		glm::vec3 world_extent = glm::abs(glm::vec3(m[0])) * e.x + glm::abs(glm::vec3(m[1])) * e.y + glm::abs(glm::vec3(m[2])) * e.z;
+		return AABB{ c - world_extent, c + world_extent };
+	}
+};
+
+struct BoundingSphere {
+	glm::vec3 center = glm::vec3(.0f);
+	float radius = .0f;
+
+	// sphere around a box, moved by m; the radius grows with m's largest scale
+	static BoundingSphere around(const AABB& box, const glm::mat4& m) {
+		float scale = std::sqrt(std::max({
+			glm::dot(glm::vec3(m[0]), glm::vec3(m[0])),
+			glm::dot(glm::vec3(m[1]), glm::vec3(m[1])),
+			glm::dot(glm::vec3(m[2]), glm::vec3(m[2])),
+		}));
+		return BoundingSphere{ glm::vec3(m * glm::vec4(box.center(), 1.0f)), glm::length(box.extent()) * scale };
+	}
+};
+
+// Six normalized planes with the inside where dot(n, p) + d >= 0
+struct Frustum {
+	glm::vec4 planes[6];
+
+	// from a view-projection matrix with OpenGL clip space (Gribb/Hartmann)
+	static Frustum from_matrix(const glm::mat4& vp) {
+		glm::vec4 row[4];
+		for (int i = 0; i < 4; ++i) {
+			row[i] = glm::vec4(vp[0][i], vp[1][i], vp[2][i], vp[3][i]);
+		}
+		Frustum f;
+		f.planes[0] = row[3] + row[0];
+		f.planes[1] = row[3] - row[0];
+		f.planes[2] = row[3] + row[1];
+		f.planes[3] = row[3] - row[1];
+		f.planes[4] = row[3] + row[2];
+		f.planes[5] = row[3] - row[2];
+		for (glm::vec4& plane : f.planes) {
+			plane /= glm::length(glm::vec3(plane));
+		}
+		return f;
+	}
+
+	enum Containment {
+		OUTSIDE,
+		INTERSECTS,
+		INSIDE,
+	};
+
+	Containment classify(const AABB& box) const {
+		glm::vec3 c = box.center();
+		glm::vec3 e = box.extent();
+		Containment result = INSIDE;
+		for (const glm::vec4& plane : planes) {
+			float dist = glm::dot(glm::vec3(plane), c) + plane.w;
+			float radius = glm::dot(glm::abs(glm::vec3(plane)), e);
+			if (dist < -radius) {
+				return OUTSIDE;
+			}
+			if (dist < radius) {
+				result = INTERSECTS;
+			}
+		}
+		return result;
+	}
+
+	bool intersects(const AABB& box) const {
+		return classify(box) != OUTSIDE;
+	}
+};
+
+// World bounds of many objects as SoA for cull_bounds: AABB center and half
+// extent, plus the radius of a bounding sphere around the same center.
+struct BoundsSoA {
+	std::vector<float> center_x, center_y, center_z;
+	std::vector<float> extent_x, extent_y, extent_z;
+	std::vector<float> radius;
+
+	void resize(size_t n) {
+		for (auto* v : { &center_x, &center_y, &center_z, &extent_x, &extent_y, &extent_z, &radius }) {
+			v->resize(n);
+		}
+	}
+
+	size_t size() const {
+		return radius.size();
+	}
+
+	void set(size_t i, const AABB& box, float sphere_radius) {
+		glm::vec3 c = box.center();
+		glm::vec3 e = box.extent();
+		center_x[i] = c.x; center_y[i] = c.y; center_z[i] = c.z;
+		extent_x[i] = e.x; extent_y[i] = e.y; extent_z[i] = e.z;
+		radius[i] = sphere_radius;
+	}
+
+	AABB aabb(size_t i) const {
+		glm::vec3 c(center_x[i], center_y[i], center_z[i]);
+		glm::vec3 e(extent_x[i], extent_y[i], extent_z[i]);
+		return AABB{ c - e, c + e };
+	}
+};
+
+// scalar version of the cull_bounds test for a single object
+inline bool bounds_visible(const Frustum& frustum, const BoundsSoA& bounds, size_t i) {
+	for (const glm::vec4& plane : frustum.planes) {
+		float dist = plane.x * bounds.center_x[i] + plane.y * bounds.center_y[i] + plane.z * bounds.center_z[i] + plane.w;
+		float box_radius = std::abs(plane.x) * bounds.extent_x[i] + std::abs(plane.y) * bounds.extent_y[i] + std::abs(plane.z) * bounds.extent_z[i];
+		if (dist < -std::min(box_radius, bounds.radius[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Writes visible[k] = 1 for every object first + k, k < count, that is not
+// outside a frustum plane. An object is outside a plane when either its box
+// or its sphere is, so the tighter of the two decides per plane.
+inline void cull_bounds(const Frustum& frustum, const BoundsSoA& bounds, size_t first, size_t count, uint8_t* visible) {
+	size_t k = 0;
+#ifdef QUICKGL_SSE
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	for (; k + 4 <= count; k += 4) {
+		size_t i = first + k;
+		__m128 cx = _mm_loadu_ps(&bounds.center_x[i]);
+		__m128 cy = _mm_loadu_ps(&bounds.center_y[i]);
+		__m128 cz = _mm_loadu_ps(&bounds.center_z[i]);
+		__m128 ex = _mm_loadu_ps(&bounds.extent_x[i]);
+		__m128 ey = _mm_loadu_ps(&bounds.extent_y[i]);
+		__m128 ez = _mm_loadu_ps(&bounds.extent_z[i]);
+		__m128 r = _mm_loadu_ps(&bounds.radius[i]);
+		__m128 outside = _mm_setzero_ps();
+		for (const glm::vec4& plane : frustum.planes) {
+			__m128 nx = _mm_set1_ps(plane.x);
+			__m128 ny = _mm_set1_ps(plane.y);
+			__m128 nz = _mm_set1_ps(plane.z);
+			__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+				_mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(plane.w)));
+			__m128 box_radius = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(_mm_andnot_ps(sign_mask, nx), ex),
+				_mm_mul_ps(_mm_andnot_ps(sign_mask, ny), ey)),
+				_mm_mul_ps(_mm_andnot_ps(sign_mask, nz), ez));
+			__m128 limit = _mm_xor_ps(_mm_min_ps(box_radius, r), sign_mask);
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(dist, limit));
+		}
+		int mask = _mm_movemask_ps(outside);
+		visible[k] = !(mask & 1);
+		visible[k + 1] = !(mask & 2);
+		visible[k + 2] = !(mask & 4);
+		visible[k + 3] = !(mask & 8);
+	}
+#endif
+	for (; k < count; ++k) {
+		visible[k] = bounds_visible(frustum, bounds, first + k);
+	}
+}
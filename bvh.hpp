@@ -0,0 +1,352 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <numeric>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "bounds.hpp"
+
+// Bounding volume hierarchy over the AABBs of a BoundsSoA, built top-down
+// with binned SAH. Children are stored after their parent, so refit() can
+// recompute all bounds bottom-up in one reverse pass when objects move
+// without changing the tree.
+struct BVH {
+	static constexpr uint32_t MAX_LEAF_SIZE = 4;
+	static constexpr int BINS = 12;
+	// deeper nodes become leaves, which bounds the traversal stacks
+	static constexpr int MAX_DEPTH = 48;
+	static constexpr int STACK_SIZE = MAX_DEPTH + 2;
+
+	struct Node {
+		AABB bounds;
+		// leaf: objects indices[first, first + count); inner: children first, first + 1
+		uint32_t first = 0;
+		uint32_t count = 0;
+
+		bool leaf() const {
+			return count > 0;
+		}
+	};
+
+	std::vector<Node> nodes;
+	// object indices, grouped by leaf
+	std::vector<uint32_t> indices;
+
+	void build(const BoundsSoA& bounds);
+	void refit(const BoundsSoA& bounds);
+
+	bool empty() const {
+		return nodes.empty();
+	}
+
+	// Calls visit(object, inside) for every object whose node is not outside
+	// the frustum. inside is true when the whole node is in the frustum, the
+	// object needs no test of its own then. Starts at node root.
+	template<typename F>
+	void cull(const Frustum& frustum, uint32_t root, F&& visit) const;
+
+	// Nearest hit along the ray: hit(object, t_max) returns the distance to the
+	// object or FLT_MAX. Returns the object or -1, writing its distance to t.
+	template<typename F>
+	int64_t raycast(const glm::vec3& origin, const glm::vec3& dir, F&& hit, float& t) const;
+
+	// fn(object) for every object whose AABB overlaps the query
+	template<typename F>
+	void overlap(const AABB& box, const BoundsSoA& bounds, F&& fn) const;
+	template<typename F>
+	void overlap(const BoundingSphere& sphere, const BoundsSoA& bounds, F&& fn) const;
+
+	// inner nodes expanded breadth first until there are at least count
+	// disjoint subtrees, or none can be split further
+	void subtrees(size_t count, std::vector<uint32_t>& out) const;
+
+	static float ray_box(const AABB& box, const glm::vec3& origin, const glm::vec3& inv_dir, float t_max);
+};
+
+void BVH::build(const BoundsSoA& bounds) {
+	size_t n = bounds.size();
+	nodes.clear();
+	indices.resize(n);
+	std::iota(indices.begin(), indices.end(), 0);
+	if (n == 0) {
+		return;
+	}
+	nodes.reserve(2 * n);
+
+	std::vector<AABB> boxes(n);
+	std::vector<glm::vec3> centroids(n);
+	for (size_t i = 0; i < n; ++i) {
+		boxes[i] = bounds.aabb(i);
+		centroids[i] = boxes[i].center();
+	}
+
+	nodes.push_back(Node{ AABB{}, 0, static_cast<uint32_t>(n) });
+	// (node, depth)
+	std::vector<std::pair<uint32_t, int>> stack{ { 0, 0 } };
+	while (!stack.empty()) {
+		auto [node_index, depth] = stack.back();
+		stack.pop_back();
+		Node node = nodes[node_index];
+
+		AABB node_bounds, centroid_bounds;
+		for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+			node_bounds.expand(boxes[indices[i]]);
+			centroid_bounds.expand(centroids[indices[i]]);
+		}
+		nodes[node_index].bounds = node_bounds;
+		if (node.count <= MAX_LEAF_SIZE || depth >= MAX_DEPTH) {
+			continue;
+		}
+
+		glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		if (extent[axis] <= .0f) {
+			continue;
+		}
+
+		// bin centroids along the widest axis and pick the cheapest split
+		struct Bin {
+			AABB bounds;
+			uint32_t count = 0;
+		} bins[BINS];
+		float scale = BINS / extent[axis];
+		auto bin_of = [&](uint32_t object) {
+			int b = static_cast<int>((centroids[object][axis] - centroid_bounds.min[axis]) * scale);
+			return std::min(b, BINS - 1);
+		};
+		for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+			Bin& bin = bins[bin_of(indices[i])];
+			bin.bounds.expand(boxes[indices[i]]);
+			bin.count += 1;
+		}
+		float right_area[BINS];
+		uint32_t right_count[BINS];
+		AABB acc;
+		uint32_t count = 0;
+		for (int b = BINS - 1; b > 0; --b) {
+			acc.expand(bins[b].bounds);
+			count += bins[b].count;
+			right_area[b] = acc.empty() ? .0f : acc.surface_area();
+			right_count[b] = count;
+		}
+		float best_cost = FLT_MAX;
+		int best_split = -1;
+		acc = AABB{};
+		count = 0;
+		for (int b = 1; b < BINS; ++b) {
+			acc.expand(bins[b - 1].bounds);
+			count += bins[b - 1].count;
+			if (count == 0 || right_count[b] == 0) {
+				continue;
+			}
+			float cost = acc.surface_area() * count + right_area[b] * right_count[b];
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_split = b;
+			}
+		}
+		if (best_split < 0) {
+			continue;
+		}
+
+		auto middle = std::partition(indices.begin() + node.first, indices.begin() + node.first + node.count,
+			[&](uint32_t object) { return bin_of(object) < best_split; });
+		uint32_t left_count = static_cast<uint32_t>(middle - (indices.begin() + node.first));
+
+		uint32_t left = static_cast<uint32_t>(nodes.size());
+		nodes.push_back(Node{ AABB{}, node.first, left_count });
+		nodes.push_back(Node{ AABB{}, node.first + left_count, node.count - left_count });
+		nodes[node_index].first = left;
+		nodes[node_index].count = 0;
+		stack.push_back({ left, depth + 1 });
+		stack.push_back({ left + 1, depth + 1 });
+	}
+}
+
+void BVH::refit(const BoundsSoA& bounds) {
+	for (size_t i = nodes.size(); i-- > 0;) {
+		Node& node = nodes[i];
+		AABB box;
+		if (node.leaf()) {
+			for (uint32_t k = node.first; k < node.first + node.count; ++k) {
+				box.expand(bounds.aabb(indices[k]));
+			}
+		} else {
+			box = nodes[node.first].bounds;
+			box.expand(nodes[node.first + 1].bounds);
+		}
+		node.bounds = box;
+	}
+}
+
+template<typename F>
+void BVH::cull(const Frustum& frustum, uint32_t root, F&& visit) const {
+	if (nodes.empty()) {
+		return;
+	}
+	// (node, parent was fully inside)
+	uint32_t stack[STACK_SIZE];
+	bool inside_stack[STACK_SIZE];
+	int top = 0;
+	stack[top] = root;
+	inside_stack[top++] = false;
+	while (top > 0) {
+		--top;
+		const Node& node = nodes[stack[top]];
+		bool inside = inside_stack[top];
+		if (!inside) {
+			Frustum::Containment c = frustum.classify(node.bounds);
+			if (c == Frustum::OUTSIDE) {
+				continue;
+			}
+			inside = c == Frustum::INSIDE;
+		}
+		if (node.leaf()) {
+			for (uint32_t k = node.first; k < node.first + node.count; ++k) {
+				visit(indices[k], inside);
+			}
+			continue;
+		}
+		stack[top] = node.first;
+		inside_stack[top++] = inside;
+		stack[top] = node.first + 1;
+		inside_stack[top++] = inside;
+	}
+}
+
+float BVH::ray_box(const AABB& box, const glm::vec3& origin, const glm::vec3& inv_dir, float t_max) {
+	glm::vec3 t0 = (box.min - origin) * inv_dir;
+	glm::vec3 t1 = (box.max - origin) * inv_dir;
+	glm::vec3 t_near = glm::min(t0, t1);
+	glm::vec3 t_far = glm::max(t0, t1);
+	float t_enter = std::max({ t_near.x, t_near.y, t_near.z, .0f });
+	float t_exit = std::min({ t_far.x, t_far.y, t_far.z, t_max });
+	return t_enter <= t_exit ? t_enter : FLT_MAX;
+}
+
+template<typename F>
+int64_t BVH::raycast(const glm::vec3& origin, const glm::vec3& dir, F&& hit, float& t) const {
+	t = FLT_MAX;
+	int64_t result = -1;
+	if (nodes.empty()) {
+		return result;
+	}
+	glm::vec3 inv_dir = 1.0f / dir;
+	uint32_t stack[STACK_SIZE];
+	int top = 0;
+	if (ray_box(nodes[0].bounds, origin, inv_dir, t) < FLT_MAX) {
+		stack[top++] = 0;
+	}
+	while (top > 0) {
+		const Node& node = nodes[stack[--top]];
+		if (ray_box(node.bounds, origin, inv_dir, t) == FLT_MAX) {
+			continue;
+		}
+		if (node.leaf()) {
+			for (uint32_t k = node.first; k < node.first + node.count; ++k) {
+				float d = hit(indices[k], t);
+				if (d < t) {
+					t = d;
+					result = indices[k];
+				}
+			}
+			continue;
+		}
+		// visit the nearer child first
+		uint32_t a = node.first, b = node.first + 1;
+		float ta = ray_box(nodes[a].bounds, origin, inv_dir, t);
+		float tb = ray_box(nodes[b].bounds, origin, inv_dir, t);
+		if (ta > tb) {
+			std::swap(a, b);
+			std::swap(ta, tb);
+		}
+		if (tb < FLT_MAX) {
+			stack[top++] = b;
+		}
+		if (ta < FLT_MAX) {
+			stack[top++] = a;
+		}
+	}
+	return result;
+}
+
+template<typename F>
+void BVH::overlap(const AABB& box, const BoundsSoA& bounds, F&& fn) const {
+	auto overlaps = [&box](const AABB& other) {
+		return glm::all(glm::lessThanEqual(box.min, other.max)) && glm::all(glm::lessThanEqual(other.min, box.max));
+	};
+	uint32_t stack[STACK_SIZE];
+	int top = 0;
+	if (!nodes.empty()) {
+		stack[top++] = 0;
+	}
+	while (top > 0) {
+		const Node& node = nodes[stack[--top]];
+		if (!overlaps(node.bounds)) {
+			continue;
+		}
+		if (node.leaf()) {
+			for (uint32_t k = node.first; k < node.first + node.count; ++k) {
+				if (overlaps(bounds.aabb(indices[k]))) {
+					fn(indices[k]);
+				}
+			}
+			continue;
+		}
+		stack[top++] = node.first;
+		stack[top++] = node.first + 1;
+	}
+}
+
+template<typename F>
+void BVH::overlap(const BoundingSphere& sphere, const BoundsSoA& bounds, F&& fn) const {
+	auto overlaps = [&sphere](const AABB& box) {
+		glm::vec3 d = sphere.center - glm::clamp(sphere.center, box.min, box.max);
+		return glm::dot(d, d) <= sphere.radius * sphere.radius;
+	};
+	uint32_t stack[STACK_SIZE];
+	int top = 0;
+	if (!nodes.empty()) {
+		stack[top++] = 0;
+	}
+	while (top > 0) {
+		const Node& node = nodes[stack[--top]];
+		if (!overlaps(node.bounds)) {
+			continue;
+		}
+		if (node.leaf()) {
+			for (uint32_t k = node.first; k < node.first + node.count; ++k) {
+				if (overlaps(bounds.aabb(indices[k]))) {
+					fn(indices[k]);
+				}
+			}
+			continue;
+		}
+		stack[top++] = node.first;
+		stack[top++] = node.first + 1;
+	}
+}
+
+void BVH::subtrees(size_t count, std::vector<uint32_t>& out) const {
+	out.clear();
+	if (nodes.empty()) {
+		return;
+	}
+	out.push_back(0);
+	bool split = true;
+	while (out.size() < count && split) {
+		split = false;
+		size_t n = out.size();
+		for (size_t i = 0; i < n && out.size() < count; ++i) {
+			const Node& node = nodes[out[i]];
+			if (!node.leaf()) {
+				out[i] = node.first;
+				out.push_back(node.first + 1);
+				split = true;
+			}
+		}
+	}
+}
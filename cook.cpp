@@ -0,0 +1,50 @@
+#include <iostream>
+#include <string>
+
+#include <glad/glad.h>
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "scene_cache.hpp"
+
+// Cooks glTF scenes into the .qglc caches QuickOpenGL loads in their place.
+// Geometry flags have to match the ones QuickOpenGL runs with, or it falls
+// back to the glTF.
+int main(int argc, char** argv)
+{
+	uint32_t flags = SceneCache::SCF_OPTIMIZE | SceneCache::SCF_QUANTIZE | SceneCache::SCF_LODS | SceneCache::SCF_MESHLETS;
+	std::string input, output;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--no-optimize") {
+			flags &= ~SceneCache::SCF_OPTIMIZE;
+		} else if (arg == "--no-quantize") {
+			flags &= ~SceneCache::SCF_QUANTIZE;
+		} else if (arg == "--no-lods") {
+			flags &= ~SceneCache::SCF_LODS;
+		} else if (arg == "--no-meshlets") {
+			flags &= ~SceneCache::SCF_MESHLETS;
+		} else if (arg == "-o" && i + 1 < argc) {
+			output = argv[++i];
+		} else if (input.empty()) {
+			input = arg;
+		} else {
+			std::cerr << "unexpected argument: " << arg << std::endl;
+			return -1;
+		}
+	}
+	if (input.empty()) {
+		std::cerr << "usage: qglc_cook [--no-optimize] [--no-quantize] [--no-lods] [--no-meshlets] scene.gltf [-o scene.qglc]" << std::endl;
+		return -1;
+	}
+	if (output.empty()) {
+		output = SceneCache::path_for(input);
+	}
+	std::string err;
+	if (!SceneCache::cook(input, output, flags, err)) {
+		std::cerr << err << std::endl;
+		return -1;
+	}
+	std::cout << "cooked " << input << " into " << output << std::endl;
+	return 0;
+}
@@ -0,0 +1,198 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include "gl_state.hpp"
+
+// ARB_buffer_storage is core in 4.4 only, so glad (generated for 4.3) does
+// not load it for us
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+typedef void (APIENTRYP PFN_glBufferStorage)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+// Streaming buffer for per-frame data. The buffer is split into REGIONS
+// regions, one per frame in flight, written front to back. With
+// ARB_buffer_storage it stays persistently mapped and a fence per region
+// stops the CPU from overwriting data the GPU may still read; without it
+// writes fall back to glBufferSubData.
+struct DynamicBuffer {
+	static constexpr int REGIONS = 3;
+	// every write starts on this boundary, so offsets of mat4 arrays can be
+	// turned into instance indices
+	static constexpr size_t ALIGNMENT = 64;
+	static inline bool allow_persistent = true;
+
+	explicit DynamicBuffer(size_t region_size = 1 << 20);
+	~DynamicBuffer();
+	DynamicBuffer(const DynamicBuffer&) = delete;
+	DynamicBuffer& operator=(const DynamicBuffer&) = delete;
+
+	// makes sure the next writes totalling size bytes land in the same buffer;
+	// growing recreates the buffer, so reserve before writing data that is
+	// referenced together
+	void reserve(size_t size);
+	// copies data into the current region, returns its offset in the buffer
+	size_t write(const void* data, size_t size);
+	// fences the current region and moves on to the next one
+	void end_frame();
+	void print_stats(std::ostream& os) const;
+
+	GLuint handle = 0;
+	bool persistent = false;
+	// bumped whenever the buffer is recreated, i.e. handle must be rebound
+	uint32_t version = 0;
+
+	uint64_t frames = 0, stalls = 0, grows = 0;
+	double stall_ms = .0, max_stall_ms = .0;
+private:
+	void create(size_t region_size);
+	void destroy();
+	void wait_region();
+
+	static inline PFN_glBufferStorage buffer_storage = nullptr;
+
+	size_t region_size = 0;
+	int region = 0;
+	size_t offset = 0;
+	bool region_acquired = false;
+	unsigned char* mapped = nullptr;
+	std::array<GLsync, REGIONS> fences{};
+};
+
+DynamicBuffer::DynamicBuffer(size_t region_size) {
+	if (allow_persistent && (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 4)
+			|| glfwExtensionSupported("GL_ARB_buffer_storage"))) {
+		buffer_storage = reinterpret_cast<PFN_glBufferStorage>(glfwGetProcAddress("glBufferStorage"));
+	}
+	create(region_size);
+	std::cout << "dynamic buffer: " << REGIONS << " x " << region_size / 1024 << " KiB, "
+		<< (persistent ? "persistently mapped" : "glBufferSubData fallback") << std::endl;
+}
+
+DynamicBuffer::~DynamicBuffer() {
+	destroy();
+}
+
+void DynamicBuffer::create(size_t region_size) {
+	this->region_size = region_size;
+	region = 0;
+	offset = 0;
+	region_acquired = false;
+	version += 1;
+
+	glGenBuffers(1, &handle);
+	GLState::getInstance()->bind_buffer(GL_ARRAY_BUFFER, handle);
+	size_t total = region_size * REGIONS;
+	persistent = buffer_storage != nullptr;
+	if (persistent) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		buffer_storage(GL_ARRAY_BUFFER, total, nullptr, flags);
+		mapped = static_cast<unsigned char*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, total, flags));
+		if (mapped == nullptr) {
+			std::cerr << "failed to map dynamic buffer, falling back to glBufferSubData" << std::endl;
+			GLState::getInstance()->invalidate();
+			glDeleteBuffers(1, &handle);
+			buffer_storage = nullptr;
+			create(region_size);
+			return;
+		}
+	} else {
+		glBufferData(GL_ARRAY_BUFFER, total, nullptr, GL_STREAM_DRAW);
+	}
+}
+
+void DynamicBuffer::destroy() {
+	for (GLsync& fence : fences) {
+		if (fence != nullptr) {
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+	}
+	if (mapped != nullptr) {
+		GLState::getInstance()->bind_buffer(GL_ARRAY_BUFFER, handle);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		mapped = nullptr;
+	}
+	if (handle != 0) {
+		glDeleteBuffers(1, &handle);
+		handle = 0;
+		// the name may be handed out again, drop every cached binding
+		GLState::getInstance()->invalidate();
+	}
+}
+
+void DynamicBuffer::wait_region() {
+	region_acquired = true;
+	GLsync& fence = fences[region];
+	if (fence == nullptr) {
+		return;
+	}
+	if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+		auto start = std::chrono::high_resolution_clock::now();
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {
+		}
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		stalls += 1;
+		stall_ms += ms;
+		max_stall_ms = std::max(max_stall_ms, ms);
+	}
+	glDeleteSync(fence);
+	fence = nullptr;
+}
+
+void DynamicBuffer::reserve(size_t size) {
+	size_t aligned = (offset + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	if (aligned + size <= region_size) {
+		return;
+	}
+	// draws already issued keep the old buffer alive until they finish
+	size_t new_size = std::max(region_size * 2, (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1));
+	destroy();
+	create(new_size);
+	grows += 1;
+}
+
+size_t DynamicBuffer::write(const void* data, size_t size) {
+	reserve(size);
+	size_t aligned = (offset + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	if (!region_acquired) {
+		wait_region();
+	}
+	size_t at = region * region_size + aligned;
+	if (persistent) {
+		std::memcpy(mapped + at, data, size);
+	} else {
+		GLState::getInstance()->bind_buffer(GL_ARRAY_BUFFER, handle);
+		glBufferSubData(GL_ARRAY_BUFFER, at, size, data);
+	}
+	offset = aligned + size;
+	return at;
+}
+
+void DynamicBuffer::end_frame() {
+	if (region_acquired && persistent) {
+		fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	region = (region + 1) % REGIONS;
+	offset = 0;
+	region_acquired = false;
+	frames += 1;
+}
+
+void DynamicBuffer::print_stats(std::ostream& os) const {
+	os << "dynamic buffer: " << (persistent ? "persistent" : "fallback")
+		<< ", " << REGIONS << " x " << region_size / 1024 << " KiB"
+		<< ", " << stalls << " stalls in " << frames << " frames"
+		<< ", " << stall_ms << " ms waited (max " << max_stall_ms << " ms)"
+		<< ", " << grows << " grows" << std::endl;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
+// Typed linear arena for per-frame data. reset() just rewinds, so once the
+// capacity has grown to a frame's high water mark no further allocation happens.
+template<typename T>
+struct FrameArena {
+	static_assert(std::is_trivially_copyable_v<T>, "FrameArena holds plain records only");
+
+	explicit FrameArena(size_t initial_capacity = 256) {
+		reserve(initial_capacity);
+	}
+
+	uint32_t push(const T& value) {
+		if (count == capacity) {
+			reserve(capacity * 2);
+		}
+		storage[count] = value;
+		return static_cast<uint32_t>(count++);
+	}
+
+	// n contiguous elements, valid until the next push/alloc/reset
+	T* alloc(size_t n) {
+		if (count + n > capacity) {
+			reserve(std::max(capacity * 2, count + n));
+		}
+		T* ptr = storage.get() + count;
+		count += n;
+		return ptr;
+	}
+
+	void reset() {
+		count = 0;
+	}
+
+	void reserve(size_t new_capacity) {
+		if (new_capacity <= capacity) {
+			return;
+		}
+		std::unique_ptr<T[]> new_storage(new T[new_capacity]);
+		if (count > 0) {
+			std::memcpy(new_storage.get(), storage.get(), count * sizeof(T));
+		}
+		storage = std::move(new_storage);
+		capacity = new_capacity;
+		grow_count += 1;
+	}
+
+	T& operator[](size_t i) { return storage[i]; }
+	const T& operator[](size_t i) const { return storage[i]; }
+	T* begin() { return storage.get(); }
+	T* end() { return storage.get() + count; }
+	T* data() { return storage.get(); }
+	const T* begin() const { return storage.get(); }
+	const T* end() const { return storage.get() + count; }
+	const T* data() const { return storage.get(); }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	size_t grow_count = 0;
+private:
+	std::unique_ptr<T[]> storage;
+	size_t count = 0;
+	size_t capacity = 0;
+};
@@ -0,0 +1,505 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <numeric>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include "utils.hpp"
+#include "gl_state.hpp"
+#include "gltf_accessor.hpp"
+#include "mesh_simplify.hpp"
+#include "mesh_optimize.hpp"
+#include "meshlet.hpp"
+
+// layout of glMultiDrawElementsIndirect commands
+struct DrawElementsIndirectCommand {
+	uint32_t count;
+	uint32_t instance_count;
+	uint32_t first_index;
+	int32_t base_vertex;
+	uint32_t base_instance;
+};
+
+// where a primitive lives inside a GeometryPool
+struct GeometryRange {
+	uint32_t first_index = 0;
+	uint32_t index_count = 0;
+	int32_t base_vertex = 0;
+	uint32_t vertex_count = 0;
+	// GL_UNSIGNED_SHORT ranges live in the pool's narrow index buffer and
+	// count first_index in its elements
+	GLenum index_type = GL_UNSIGNED_INT;
+	// uploaded positions p decode to offset + scale * p, as (offset, scale)
+	glm::vec4 dequantize = glm::vec4(.0f, .0f, .0f, 1.0f);
+
+	glm::mat4 dequantization() const {
+		return glm::mat4(
+			glm::vec4(dequantize.w, .0f, .0f, .0f),
+			glm::vec4(.0f, dequantize.w, .0f, .0f),
+			glm::vec4(.0f, .0f, dequantize.w, .0f),
+			glm::vec4(glm::vec3(dequantize), 1.0f));
+	}
+};
+
+// one level of detail of a primitive; error is the simplification error
+// relative to the primitive's extent, 0 for the original
+struct GeometryLod {
+	GeometryRange range;
+	float error = .0f;
+};
+
+// All static geometry of a scene in one interleaved vertex buffer, drawn
+// through two VAOs: one with 16 bit indices for the primitives whose vertices
+// they can address, one with 32 bit indices for the rest. Indices are
+// relative to base_vertex. Primitives are appended on the CPU with add() and
+// uploaded together by upload().
+struct GeometryPool {
+	struct Vertex {
+		glm::vec3 position;
+		glm::vec2 texcoord;
+		glm::vec3 normal;
+	};
+
+	// Vertex as uploaded with quantize: positions as unorm16 within the
+	// range's bounds, normals as snorm 10_10_10_2, texcoords as half floats.
+	// Attributes decode them for the shaders, except for the positions'
+	// offset and scale, which go into the model matrix.
+	struct QuantizedVertex {
+		uint16_t position[4];
+		uint32_t normal;
+		uint16_t texcoord[2];
+	};
+	static_assert(sizeof(QuantizedVertex) == 16);
+
+	// primitives with at most this many vertices get 16 bit indices
+	static constexpr uint32_t NARROW_VERTEX_LIMIT = 1u << 16;
+
+	GLuint vao = 0, narrow_vao = 0;
+	GLuint vertex_buffer = 0;
+	GLuint index_buffer = 0, narrow_index_buffer = 0;
+	size_t vertex_count = 0;
+	size_t index_count = 0, narrow_index_count = 0;
+	// version of the buffer last passed to bind_instance_buffer()
+	uint32_t instance_buffer_version = 0;
+	// weld, clean up and reorder the triangle lists passed to add(), see
+	// optimize_primitive()
+	bool optimize = false;
+	// upload QuantizedVertex instead of Vertex; set before the first add()
+	bool quantize = false;
+
+	GeometryRange add(const tinygltf::Model& model, const tinygltf::Primitive& primitive);
+	// Appends up to max_levels - 1 simplified index ranges of the triangle
+	// list base, each with about half the triangles of the one before and
+	// sharing base's vertices. out gets base and every level kept.
+	void add_lods(const GeometryRange& base, size_t max_levels, float max_error, std::vector<GeometryLod>& out);
+	// Reorders the indices of the triangle list base into meshlets, see
+	// build_meshlets(); out gets them with first_index into base's index array.
+	// With optimize, every meshlet is then ordered for the vertex cache on its
+	// own; the overdraw order optimize_primitive() gave base is lost.
+	void add_meshlets(const GeometryRange& base, std::vector<Meshlet>& out);
+	void upload();
+	// uploads buffer contents that an earlier upload() would have sent, e.g.
+	// from a SceneCache; vertex_data holds QuantizedVertex or Vertex by quantize
+	void upload(const void* vertex_data, size_t vertex_count, const uint32_t* index_data, size_t index_count,
+		const uint16_t* narrow_index_data, size_t narrow_index_count);
+	// upload() in parts, for callers with a time budget: stage_upload() packs
+	// the vertices as uploaded and touches no GL state, then each
+	// upload_part() sends up to max_bytes more of the vertices and indices.
+	// It returns true once all are sent and frees them like upload().
+	void stage_upload();
+	bool upload_part(size_t max_bytes);
+	// what upload() is going to send, for as long as it has not
+	std::vector<unsigned char> vertex_data() const;
+	const std::vector<uint32_t>& staged_indices() const {
+		return indices;
+	}
+	const std::vector<uint16_t>& staged_narrow_indices() const {
+		return narrow_indices;
+	}
+	// buffer feeds the per-instance model matrix at model_location
+	void bind_instance_buffer(GLuint buffer, uint32_t version, GLuint model_location);
+	// the VAO drawing ranges of index_type
+	GLuint vao_of(GLenum index_type) const {
+		return index_type == GL_UNSIGNED_SHORT ? narrow_vao : vao;
+	}
+
+private:
+	// Welds equal vertices, drops degenerate triangles, reorders triangles for
+	// the vertex cache and overdraw and vertices for fetch; prints the cache
+	// miss ratios before and after
+	void optimize_primitive(std::vector<Vertex>& prim_vertices, std::vector<uint32_t>& prim_indices) const;
+	std::vector<QuantizedVertex> quantize_vertices() const;
+	std::vector<uint32_t> read_indices(const GeometryRange& range) const;
+	// overwrites the indices of range with as many new ones
+	void write_indices(const GeometryRange& range, const std::vector<uint32_t>& data);
+	// a range like range over data appended to the index array of its type
+	GeometryRange append_indices(GeometryRange range, const std::vector<uint32_t>& data);
+	void setup_vertex_attributes(GLuint vao);
+
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<uint16_t> narrow_indices;
+	// every range returned by add(), for quantize_vertices()
+	std::vector<GeometryRange> ranges;
+	// stage_upload()'s vertices, and the bytes upload_part() has sent of
+	// them, the indices and the narrow indices, in that order
+	std::vector<unsigned char> staged_vertices;
+	bool staged = false;
+	size_t uploaded_bytes = 0;
+};
+
+GeometryRange GeometryPool::add(const tinygltf::Model& model, const tinygltf::Primitive& primitive) {
+	auto attribute = [&](const char* name) -> std::vector<float> {
+		auto it = primitive.attributes.find(name);
+		if (it == primitive.attributes.end()) {
+			return {};
+		}
+		return read_accessor_floats(model, model.accessors[it->second]);
+	};
+	std::vector<float> positions = attribute("POSITION");
+	std::vector<float> texcoords = attribute("TEXCOORD_0");
+	std::vector<float> normals = attribute("NORMAL");
+
+	std::vector<Vertex> prim_vertices(positions.size() / 3);
+	for (size_t i = 0; i < prim_vertices.size(); ++i) {
+		Vertex& vertex = prim_vertices[i];
+		vertex.position = glm::vec3(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]);
+		if (texcoords.size() >= (i + 1) * 2) {
+			vertex.texcoord = glm::vec2(texcoords[i * 2], texcoords[i * 2 + 1]);
+		}
+		if (normals.size() >= (i + 1) * 3) {
+			vertex.normal = glm::vec3(normals[i * 3], normals[i * 3 + 1], normals[i * 3 + 2]);
+		}
+	}
+
+	std::vector<uint32_t> prim_indices;
+	if (primitive.indices >= 0) {
+		prim_indices = read_accessor_indices(model, model.accessors[primitive.indices]);
+	} else {
+		prim_indices.resize(prim_vertices.size());
+		std::iota(prim_indices.begin(), prim_indices.end(), 0);
+	}
+	if (optimize && primitive.mode == TINYGLTF_MODE_TRIANGLES) {
+		optimize_primitive(prim_vertices, prim_indices);
+	}
+
+	GeometryRange range;
+	range.base_vertex = static_cast<int32_t>(vertices.size());
+	range.vertex_count = static_cast<uint32_t>(prim_vertices.size());
+	range.index_type = range.vertex_count <= NARROW_VERTEX_LIMIT ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	// one scale for all axes keeps the model matrix free of shear, so
+	// normals, bounding spheres and normal cones survive it
+	if (quantize && !prim_vertices.empty()) {
+		glm::vec3 lo(prim_vertices[0].position), hi(prim_vertices[0].position);
+		for (const Vertex& vertex : prim_vertices) {
+			lo = glm::min(lo, vertex.position);
+			hi = glm::max(hi, vertex.position);
+		}
+		glm::vec3 extent = hi - lo;
+		float scale = std::max(extent.x, std::max(extent.y, extent.z));
+		range.dequantize = glm::vec4(lo, scale > .0f ? scale : 1.0f);
+	}
+	vertices.insert(vertices.end(), prim_vertices.begin(), prim_vertices.end());
+	range = append_indices(range, prim_indices);
+	ranges.push_back(range);
+	return range;
+}
+
+std::vector<uint32_t> GeometryPool::read_indices(const GeometryRange& range) const {
+	if (range.index_type == GL_UNSIGNED_SHORT) {
+		auto first = narrow_indices.begin() + range.first_index;
+		return std::vector<uint32_t>(first, first + range.index_count);
+	}
+	auto first = indices.begin() + range.first_index;
+	return std::vector<uint32_t>(first, first + range.index_count);
+}
+
+void GeometryPool::write_indices(const GeometryRange& range, const std::vector<uint32_t>& data) {
+	if (range.index_type == GL_UNSIGNED_SHORT) {
+		std::transform(data.begin(), data.end(), narrow_indices.begin() + range.first_index, [](uint32_t v) {
+			return static_cast<uint16_t>(v);
+		});
+	} else {
+		std::copy(data.begin(), data.end(), indices.begin() + range.first_index);
+	}
+}
+
+GeometryRange GeometryPool::append_indices(GeometryRange range, const std::vector<uint32_t>& data) {
+	range.index_count = static_cast<uint32_t>(data.size());
+	if (range.index_type == GL_UNSIGNED_SHORT) {
+		range.first_index = static_cast<uint32_t>(narrow_indices.size());
+		narrow_indices.insert(narrow_indices.end(), data.begin(), data.end());
+	} else {
+		range.first_index = static_cast<uint32_t>(indices.size());
+		indices.insert(indices.end(), data.begin(), data.end());
+	}
+	return range;
+}
+
+std::vector<GeometryPool::QuantizedVertex> GeometryPool::quantize_vertices() const {
+	auto snorm10 = [](float value) {
+		return static_cast<uint32_t>(static_cast<int32_t>(std::round(std::clamp(value, -1.0f, 1.0f) * 511.0f)) & 0x3ff);
+	};
+	std::vector<QuantizedVertex> out(vertices.size());
+	for (const GeometryRange& range : ranges) {
+		glm::vec3 offset(range.dequantize);
+		float inverse_scale = 1.0f / range.dequantize.w;
+		for (uint32_t i = 0; i < range.vertex_count; ++i) {
+			const Vertex& vertex = vertices[range.base_vertex + i];
+			QuantizedVertex& q = out[range.base_vertex + i];
+			glm::vec3 unit = glm::clamp((vertex.position - offset) * inverse_scale, .0f, 1.0f);
+			for (int c = 0; c < 3; ++c) {
+				q.position[c] = static_cast<uint16_t>(std::round(unit[c] * 65535.0f));
+			}
+			q.position[3] = 0;
+			q.normal = snorm10(vertex.normal.x) | snorm10(vertex.normal.y) << 10 | snorm10(vertex.normal.z) << 20;
+			q.texcoord[0] = glm::packHalf1x16(vertex.texcoord.x);
+			q.texcoord[1] = glm::packHalf1x16(vertex.texcoord.y);
+		}
+	}
+	return out;
+}
+
+void GeometryPool::optimize_primitive(std::vector<Vertex>& prim_vertices, std::vector<uint32_t>& prim_indices) const {
+	static_assert(sizeof(Vertex) == 8 * sizeof(float), "welding compares vertices bytewise");
+	size_t vertex_count = prim_vertices.size();
+	size_t triangle_count = prim_indices.size() / 3;
+	VertexCacheStats before = analyze_vertex_cache(prim_indices, vertex_count);
+
+	std::vector<uint32_t> remap;
+	weld_vertices(prim_vertices, remap);
+	for (uint32_t& v : prim_indices) {
+		v = remap[v];
+	}
+	remove_degenerate_triangles(prim_indices);
+
+	std::vector<uint32_t> clusters;
+	optimize_vertex_cache(prim_indices, vertex_count, clusters);
+	std::vector<glm::vec3> positions(vertex_count);
+	for (size_t v = 0; v < vertex_count; ++v) {
+		positions[v] = prim_vertices[v].position;
+	}
+	optimize_overdraw(prim_indices, positions.data(), vertex_count, clusters);
+
+	std::vector<Vertex> fetched(optimize_vertex_fetch(prim_indices, vertex_count, remap));
+	for (size_t v = 0; v < vertex_count; ++v) {
+		if (remap[v] != UINT32_MAX) {
+			fetched[remap[v]] = prim_vertices[v];
+		}
+	}
+	prim_vertices = std::move(fetched);
+
+	VertexCacheStats after = analyze_vertex_cache(prim_indices, prim_vertices.size());
+	std::cout << "optimize primitive: " << vertex_count << " -> " << prim_vertices.size() << " vertices, "
+		<< triangle_count - prim_indices.size() / 3 << " degenerate triangles dropped, acmr "
+		<< before.acmr << " -> " << after.acmr << ", atvr " << before.atvr << " -> " << after.atvr << std::endl;
+}
+
+void GeometryPool::add_lods(const GeometryRange& base, size_t max_levels, float max_error, std::vector<GeometryLod>& out) {
+	out.clear();
+	out.push_back(GeometryLod{ base, .0f });
+	std::vector<glm::vec3> positions(base.vertex_count);
+	for (uint32_t i = 0; i < base.vertex_count; ++i) {
+		positions[i] = vertices[base.base_vertex + i].position;
+	}
+	std::vector<uint32_t> level = read_indices(base);
+	while (out.size() < max_levels) {
+		float error;
+		std::vector<uint32_t> simplified = simplify_mesh(positions.data(), positions.size(), level, level.size() / 2, max_error, error);
+		// a level that barely shrinks is not worth its indices
+		if (simplified.empty() || simplified.size() > level.size() * 4 / 5) {
+			break;
+		}
+		GeometryRange range = append_indices(base, simplified);
+		// each level is simplified from the one before, so errors add up
+		out.push_back(GeometryLod{ range, out.back().error + error });
+		level = std::move(simplified);
+	}
+}
+
+void GeometryPool::add_meshlets(const GeometryRange& base, std::vector<Meshlet>& out) {
+	std::vector<glm::vec3> positions(base.vertex_count);
+	for (uint32_t i = 0; i < base.vertex_count; ++i) {
+		positions[i] = vertices[base.base_vertex + i].position;
+	}
+	std::vector<uint32_t> reordered = read_indices(base);
+	VertexCacheStats before;
+	if (optimize) {
+		before = analyze_vertex_cache(reordered, base.vertex_count);
+	}
+	out = build_meshlets(positions.data(), positions.size(), reordered.data(), reordered.size());
+	if (optimize) {
+		// in meshlet local vertex numbers, so each run only sizes its tables
+		// by the meshlet's at most MAX_VERTICES vertices
+		std::vector<uint32_t> local_of(base.vertex_count, UINT32_MAX), global_of, local, clusters;
+		for (const Meshlet& meshlet : out) {
+			global_of.clear();
+			local.assign(reordered.begin() + meshlet.first_index, reordered.begin() + meshlet.first_index + meshlet.index_count);
+			for (uint32_t& v : local) {
+				if (local_of[v] == UINT32_MAX) {
+					local_of[v] = static_cast<uint32_t>(global_of.size());
+					global_of.push_back(v);
+				}
+				v = local_of[v];
+			}
+			optimize_vertex_cache(local, global_of.size(), clusters);
+			for (size_t i = 0; i < local.size(); ++i) {
+				reordered[meshlet.first_index + i] = global_of[local[i]];
+			}
+			for (uint32_t v : global_of) {
+				local_of[v] = UINT32_MAX;
+			}
+		}
+		VertexCacheStats after = analyze_vertex_cache(reordered, base.vertex_count);
+		std::cout << "meshlets: " << out.size() << " clusters, acmr " << before.acmr << " -> " << after.acmr
+			<< ", atvr " << before.atvr << " -> " << after.atvr << " as uploaded, without the overdraw order" << std::endl;
+	}
+	write_indices(base, reordered);
+	for (Meshlet& meshlet : out) {
+		meshlet.first_index += base.first_index;
+	}
+}
+
+void GeometryPool::setup_vertex_attributes(GLuint vao) {
+	auto* gl_state = GLState::getInstance();
+	gl_state->bind_vertex_array(vao);
+	gl_state->bind_buffer(GL_ARRAY_BUFFER, vertex_buffer);
+	if (quantize) {
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(QuantizedVertex), (void*)offsetof(QuantizedVertex, position));
+		glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(QuantizedVertex), (void*)offsetof(QuantizedVertex, texcoord));
+		glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(QuantizedVertex), (void*)offsetof(QuantizedVertex, normal));
+	} else {
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texcoord));
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+	}
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+}
+
+std::vector<unsigned char> GeometryPool::vertex_data() const {
+	if (quantize) {
+		std::vector<QuantizedVertex> quantized = quantize_vertices();
+		auto* bytes = reinterpret_cast<const unsigned char*>(quantized.data());
+		return std::vector<unsigned char>(bytes, bytes + quantized.size() * sizeof(QuantizedVertex));
+	}
+	auto* bytes = reinterpret_cast<const unsigned char*>(vertices.data());
+	return std::vector<unsigned char>(bytes, bytes + vertices.size() * sizeof(Vertex));
+}
+
+void GeometryPool::upload() {
+	if (quantize) {
+		std::vector<QuantizedVertex> quantized = quantize_vertices();
+		upload(quantized.data(), quantized.size(), indices.data(), indices.size(), narrow_indices.data(), narrow_indices.size());
+	} else {
+		upload(vertices.data(), vertices.size(), indices.data(), indices.size(), narrow_indices.data(), narrow_indices.size());
+	}
+	vertices = {};
+	indices = {};
+	narrow_indices = {};
+	ranges = {};
+}
+
+void GeometryPool::upload(const void* vertex_data, size_t vertex_count, const uint32_t* index_data, size_t index_count,
+	const uint16_t* narrow_index_data, size_t narrow_index_count) {
+	auto* gl_state = GLState::getInstance();
+	this->vertex_count = vertex_count;
+	this->index_count = index_count;
+	this->narrow_index_count = narrow_index_count;
+
+	glGenVertexArrays(1, &vao);
+	glGenVertexArrays(1, &narrow_vao);
+	glGenBuffers(1, &vertex_buffer);
+	glGenBuffers(1, &index_buffer);
+	glGenBuffers(1, &narrow_index_buffer);
+
+	gl_state->bind_buffer(GL_ARRAY_BUFFER, vertex_buffer);
+	size_t vertex_size = quantize ? sizeof(QuantizedVertex) : sizeof(Vertex);
+	glBufferData(GL_ARRAY_BUFFER, vertex_count * vertex_size, vertex_data, GL_STATIC_DRAW);
+
+	setup_vertex_attributes(vao);
+	gl_state->bind_buffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(uint32_t), index_data, GL_STATIC_DRAW);
+	setup_vertex_attributes(narrow_vao);
+	gl_state->bind_buffer(GL_ELEMENT_ARRAY_BUFFER, narrow_index_buffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, narrow_index_count * sizeof(uint16_t), narrow_index_data, GL_STATIC_DRAW);
+
+	size_t index_bytes = index_count * sizeof(uint32_t) + narrow_index_count * sizeof(uint16_t);
+	std::cout << "geometry pool: " << vertex_count << " vertices, " << index_count + narrow_index_count << " indices ("
+		<< narrow_index_count << " 16 bit), " << vertex_count * vertex_size / 1024 << " KiB of vertices ("
+		<< vertex_count * sizeof(Vertex) / 1024 << " KiB as floats), " << index_bytes / 1024 << " KiB of indices ("
+		<< (index_count + narrow_index_count) * sizeof(uint32_t) / 1024 << " KiB as 32 bit)" << std::endl;
+}
+
+void GeometryPool::stage_upload() {
+	staged_vertices = vertex_data();
+	vertices = {};
+	ranges = {};
+	staged = true;
+}
+
+bool GeometryPool::upload_part(size_t max_bytes) {
+	if (!staged) {
+		stage_upload();
+	}
+	if (vertex_buffer == 0) {
+		// allocated empty, the parts fill them
+		size_t vertex_size = quantize ? sizeof(QuantizedVertex) : sizeof(Vertex);
+		upload(nullptr, staged_vertices.size() / vertex_size, nullptr, indices.size(), nullptr, narrow_indices.size());
+		uploaded_bytes = 0;
+	}
+	struct Part {
+		GLuint buffer;
+		const void* data;
+		size_t size;
+	};
+	const Part parts[] = {
+		{ vertex_buffer, staged_vertices.data(), staged_vertices.size() },
+		{ index_buffer, indices.data(), indices.size() * sizeof(uint32_t) },
+		{ narrow_index_buffer, narrow_indices.data(), narrow_indices.size() * sizeof(uint16_t) },
+	};
+	auto* gl_state = GLState::getInstance();
+	size_t part_start = 0;
+	for (const Part& part : parts) {
+		if (max_bytes > 0 && uploaded_bytes < part_start + part.size) {
+			size_t offset = uploaded_bytes - part_start;
+			size_t size = std::min(max_bytes, part.size - offset);
+			// not GL_ELEMENT_ARRAY_BUFFER, which would change the bound VAO
+			gl_state->bind_buffer(GL_COPY_WRITE_BUFFER, part.buffer);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, static_cast<const unsigned char*>(part.data) + offset);
+			uploaded_bytes += size;
+			max_bytes -= size;
+		}
+		part_start += part.size;
+	}
+	if (uploaded_bytes < part_start) {
+		return false;
+	}
+	staged_vertices = {};
+	indices = {};
+	narrow_indices = {};
+	staged = false;
+	return true;
+}
+
+void GeometryPool::bind_instance_buffer(GLuint buffer, uint32_t version, GLuint model_location) {
+	auto* gl_state = GLState::getInstance();
+	for (GLuint array : { vao, narrow_vao }) {
+		gl_state->bind_vertex_array(array);
+		gl_state->bind_buffer(GL_ARRAY_BUFFER, buffer);
+		for (GLuint i = 0; i < 4; ++i) {
+			GLuint location = model_location + i;
+			glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(sizeof(glm::vec4) * i));
+			glVertexAttribDivisor(location, 1);
+			glEnableVertexAttribArray(location);
+		}
+	}
+	instance_buffer_version = version;
+}
@@ -0,0 +1,199 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <glad/glad.h>
+
+// Shadow copy of the GL bindings we touch, so redundant binds never reach the
+// driver. Everything that binds programs, VAOs, buffers or textures has to go
+// through here, otherwise the cache goes stale; call invalidate() after
+// touching state behind its back.
+struct GLState {
+public:
+	static constexpr int MAX_TEXTURE_UNITS = 16;
+
+	static GLState* getInstance();
+
+	void use_program(GLuint program);
+	void bind_vertex_array(GLuint vao);
+	void bind_buffer(GLenum target, GLuint buffer);
+	// indexed binding; also replaces the generic binding of target
+	void bind_buffer_base(GLenum target, GLuint index, GLuint buffer);
+	void active_texture(GLenum unit);
+	// binds on the given unit, e.g. GL_TEXTURE1
+	void bind_texture(GLenum unit, GLenum target, GLuint texture);
+	// binds on whichever unit is active
+	void bind_texture(GLenum target, GLuint texture);
+	void depth_mask(GLboolean mask);
+	void depth_func(GLenum func);
+	void cull_face(GLenum mode);
+	void enable_cull(bool enable);
+	void invalidate();
+
+	void print_stats(std::ostream& os) const;
+
+	uint64_t hits = 0, misses = 0;
+private:
+	static constexpr GLuint UNKNOWN = ~0u;
+
+	explicit GLState() {
+		invalidate();
+	}
+
+	bool changed(GLuint& cached, GLuint value) {
+		if (cached == value) {
+			hits += 1;
+			return false;
+		}
+		cached = value;
+		misses += 1;
+		return true;
+	}
+
+	static int buffer_slot(GLenum target);
+	static int texture_slot(GLenum target);
+
+	static inline GLState* instance = nullptr;
+	GLuint program, vao, active_unit;
+	std::array<GLuint, 5> buffers;
+	std::array<std::array<GLuint, 2>, MAX_TEXTURE_UNITS> textures;
+	GLuint depth_write, depth_test_func, cull_mode, cull_enabled;
+};
+
+GLState* GLState::getInstance() {
+	if (instance == nullptr) {
+		instance = new GLState();
+	}
+	return instance;
+}
+
+int GLState::buffer_slot(GLenum target) {
+	switch (target) {
+	case GL_ARRAY_BUFFER: return 0;
+	case GL_ELEMENT_ARRAY_BUFFER: return 1;
+	case GL_UNIFORM_BUFFER: return 2;
+	case GL_SHADER_STORAGE_BUFFER: return 3;
+	case GL_DRAW_INDIRECT_BUFFER: return 4;
+	default: return -1;
+	}
+}
+
+int GLState::texture_slot(GLenum target) {
+	switch (target) {
+	case GL_TEXTURE_2D: return 0;
+	case GL_TEXTURE_CUBE_MAP: return 1;
+	default: return -1;
+	}
+}
+
+void GLState::use_program(GLuint program) {
+	if (changed(this->program, program)) {
+		glUseProgram(program);
+	}
+}
+
+void GLState::bind_vertex_array(GLuint vao) {
+	if (changed(this->vao, vao)) {
+		glBindVertexArray(vao);
+		// the element buffer binding is part of the VAO
+		buffers[buffer_slot(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+	}
+}
+
+void GLState::bind_buffer(GLenum target, GLuint buffer) {
+	int slot = buffer_slot(target);
+	if (slot < 0) {
+		misses += 1;
+		glBindBuffer(target, buffer);
+		return;
+	}
+	if (changed(buffers[slot], buffer)) {
+		glBindBuffer(target, buffer);
+	}
+}
+
+void GLState::bind_buffer_base(GLenum target, GLuint index, GLuint buffer) {
+	misses += 1;
+	glBindBufferBase(target, index, buffer);
+	int slot = buffer_slot(target);
+	if (slot >= 0) {
+		buffers[slot] = buffer;
+	}
+}
+
+void GLState::active_texture(GLenum unit) {
+	if (changed(active_unit, unit)) {
+		glActiveTexture(unit);
+	}
+}
+
+void GLState::bind_texture(GLenum unit, GLenum target, GLuint texture) {
+	int slot = texture_slot(target);
+	int unit_index = unit - GL_TEXTURE0;
+	if (slot < 0 || unit_index < 0 || unit_index >= MAX_TEXTURE_UNITS) {
+		active_texture(unit);
+		misses += 1;
+		glBindTexture(target, texture);
+		return;
+	}
+	if (textures[unit_index][slot] == texture) {
+		hits += 1;
+		return;
+	}
+	active_texture(unit);
+	changed(textures[unit_index][slot], texture);
+	glBindTexture(target, texture);
+}
+
+void GLState::bind_texture(GLenum target, GLuint texture) {
+	if (active_unit == UNKNOWN) {
+		active_texture(GL_TEXTURE0);
+	}
+	bind_texture(active_unit, target, texture);
+}
+
+void GLState::depth_mask(GLboolean mask) {
+	if (changed(depth_write, mask)) {
+		glDepthMask(mask);
+	}
+}
+
+void GLState::depth_func(GLenum func) {
+	if (changed(depth_test_func, func)) {
+		glDepthFunc(func);
+	}
+}
+
+void GLState::cull_face(GLenum mode) {
+	if (changed(cull_mode, mode)) {
+		glCullFace(mode);
+	}
+}
+
+void GLState::enable_cull(bool enable) {
+	if (changed(cull_enabled, enable ? 1 : 0)) {
+		if (enable) {
+			glEnable(GL_CULL_FACE);
+		} else {
+			glDisable(GL_CULL_FACE);
+		}
+	}
+}
+
+void GLState::invalidate() {
+	program = vao = active_unit = UNKNOWN;
+	buffers.fill(UNKNOWN);
+	for (auto& unit : textures) {
+		unit.fill(UNKNOWN);
+	}
+	depth_write = depth_test_func = cull_mode = cull_enabled = UNKNOWN;
+}
+
+void GLState::print_stats(std::ostream& os) const {
+	uint64_t total = hits + misses;
+	os << "gl state: " << hits << " redundant calls skipped, " << misses << " issued";
+	if (total > 0) {
+		os << " (" << 100.0 * hits / total << "% skipped)";
+	}
+	os << std::endl;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "utils.hpp"
+
+// Reads one accessor component as float, applying glTF normalization rules.
+inline float read_accessor_component(const unsigned char* ptr, int component_type, bool normalized) {
+	switch (component_type) {
+	case TINYGLTF_COMPONENT_TYPE_FLOAT: {
+		float value;
+		std::memcpy(&value, ptr, sizeof(float));
+		return value;
+	}
+	case TINYGLTF_COMPONENT_TYPE_BYTE: {
+		float value = static_cast<float>(*reinterpret_cast<const int8_t*>(ptr));
+		return normalized ? std::max(value / 127.0f, -1.0f) : value;
+	}
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: {
+		float value = static_cast<float>(*ptr);
+		return normalized ? value / 255.0f : value;
+	}
+	case TINYGLTF_COMPONENT_TYPE_SHORT: {
+		int16_t raw;
+		std::memcpy(&raw, ptr, sizeof(raw));
+		float value = static_cast<float>(raw);
+		return normalized ? std::max(value / 32767.0f, -1.0f) : value;
+	}
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+		uint16_t raw;
+		std::memcpy(&raw, ptr, sizeof(raw));
+		float value = static_cast<float>(raw);
+		return normalized ? value / 65535.0f : value;
+	}
+	case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: {
+		uint32_t raw;
+		std::memcpy(&raw, ptr, sizeof(raw));
+		return static_cast<float>(raw);
+	}
+	default:
+		return .0f;
+	}
+}
+
+// Unpacks an accessor into tightly packed floats, `components` per element.
+// Accessors without a buffer view read as zeros, as the spec requires.
+inline std::vector<float> read_accessor_floats(const tinygltf::Model& model, const tinygltf::Accessor& acc) {
+	int components = tinygltf::GetNumComponentsInType(acc.type);
+	std::vector<float> out(acc.count * components, .0f);
+	if (acc.bufferView < 0) {
+		return out;
+	}
+	const tinygltf::BufferView& view = model.bufferViews[acc.bufferView];
+	const tinygltf::Buffer& buffer = model.buffers[view.buffer];
+	int stride = acc.ByteStride(view);
+	int component_size = tinygltf::GetComponentSizeInBytes(acc.componentType);
+	const unsigned char* base = buffer.data.data() + view.byteOffset + acc.byteOffset;
+	for (size_t i = 0; i < acc.count; ++i) {
+		const unsigned char* element = base + i * stride;
+		for (int c = 0; c < components; ++c) {
+			out[i * components + c] = read_accessor_component(element + c * component_size, acc.componentType, acc.normalized);
+		}
+	}
+	return out;
+}
+
+inline std::vector<uint32_t> read_accessor_indices(const tinygltf::Model& model, const tinygltf::Accessor& acc) {
+	std::vector<uint32_t> out(acc.count);
+	const tinygltf::BufferView& view = model.bufferViews[acc.bufferView];
+	const tinygltf::Buffer& buffer = model.buffers[view.buffer];
+	int stride = acc.ByteStride(view);
+	const unsigned char* base = buffer.data.data() + view.byteOffset + acc.byteOffset;
+	for (size_t i = 0; i < acc.count; ++i) {
+		const unsigned char* element = base + i * stride;
+		switch (acc.componentType) {
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+			out[i] = *element;
+			break;
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+			uint16_t value;
+			std::memcpy(&value, element, sizeof(value));
+			out[i] = value;
+			break;
+		}
+		default:
+			std::memcpy(&out[i], element, sizeof(uint32_t));
+		}
+	}
+	return out;
+}
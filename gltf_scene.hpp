@@ -1,8 +1,9 @@
 #pragma once
 #include <iostream>
 #include <algorithm>
+#include <cmath>
 #include <glad/glad.h>
-#include <deque>
+#include <vector>
 #include <memory>
 
 #include "glm/ext/matrix_transform.hpp"
@@ -10,96 +11,395 @@
 #include "shader.hpp"
 #include "camera.hpp"
 #include "material.hpp"
+#include "sort_key.hpp"
+#include "frame_arena.hpp"
+#include "gl_state.hpp"
+#include "gltf_accessor.hpp"
+#include "geometry_pool.hpp"
+#include "dynamic_buffer.hpp"
+#include "thread_pool.hpp"
+#include "scene_graph.hpp"
+#include "bounds.hpp"
+#include "bvh.hpp"
+#include "hiz_culler.hpp"
+#include "meshlet.hpp"
+#include "benchmark.hpp"
+#include "image_loader.hpp"
 
 struct GLTFScene;
-struct GLTFBufferView;
 struct GLTFPrimitive;
 struct GLTFMesh;
 struct GLTFRenderQueue;
 
-struct GLTFRenderRequest {
-	const Camera* cam;
-	glm::mat4 transform;
-	std::shared_ptr<Material> material;
-	std::shared_ptr<GLTFPrimitive> primitive;
+// one draw of a frame; indices refer to the scene's primitive and material
+// tables and to the draw list's transform arena
+struct GLTFDrawRecord {
+	static constexpr uint32_t OVERRIDE_MATERIAL = UINT32_MAX;
+
+	uint64_t key = 0;
+	uint32_t primitive;
+	uint32_t material;
+	uint32_t transform;
 	float z = .0f;
+	uint8_t lod = 0;
+};
+
+// draw records of one view, filled by GLTFScene::build and consumed by
+// GLTFRenderQueue::render
+struct GLTFDrawList {
+	Material* override_material = nullptr;
+	FrameArena<glm::mat4> transforms;
+	FrameArena<GLTFDrawRecord> opaque;
+	FrameArena<GLTFDrawRecord> blend;
+	// draw items tested against the view frustum and those that passed
+	uint32_t tested = 0;
+	uint32_t visible = 0;
+	// the view, for culling meshlets on the GPU; see GLTFView::meshlet_culling
+	bool meshlet_culling = false;
+	bool cull_back_faces = false;
+	Frustum frustum;
+	glm::vec3 eye = glm::vec3(.0f);
+
+	void reset(Material* override_material);
+	void push(const GLTFScene& scene, uint32_t primitive, const glm::mat4& transform, float z, uint8_t lod);
+	// appends the records of other, rebasing their transform indices
+	void append(const GLTFDrawList& other);
+	Material* material_of(const GLTFScene& scene, const GLTFDrawRecord& record) const;
+};
+
+// which draw items a view takes, see GLTFDrawItems::dynamic
+enum CasterLayer {
+	CL_ALL,
+	CL_STATIC,
+	CL_DYNAMIC,
+};
 
-	bool operator<(const GLTFRenderRequest& req) {
-		return z > req.z;
+// a camera and the draw list built for it
+struct GLTFView {
+	const char* name = "view";
+	Camera cam;
+	CasterLayer layer = CL_ALL;
+	// for LOD selection; a positive bias picks coarser LODs, on top of the
+	// scene's lod_bias
+	float viewport_height = VIEWPORT_HEIGHT;
+	float lod_bias = .0f;
+	std::shared_ptr<Material> override_material;
+	// tests the draws against its depth pyramid once it is ready
+	HiZCuller* occlusion = nullptr;
+	// draws with GL_CULL_FACE on for every material that is not double-sided
+	bool cull_back_faces = false;
+	// draws single instances of clustered primitives meshlet by meshlet and
+	// culls the meshlets outside the frustum; with cull_back_faces also those
+	// facing away, unless their material is double-sided
+	bool meshlet_culling = false;
+	GLTFDrawList list;
+
+	void print_stats(std::ostream& os) const {
+		os << name << " pass: " << list.tested << " tested, " << list.visible << " visible, "
+			<< list.tested - list.visible << " culled" << std::endl;
 	}
 };
 
+// number of draw calls and GL state changes a sequence of draws costs;
+// draws counts indirect commands, submits the GL calls issuing them
+struct RenderStats {
+	uint32_t draws = 0;
+	uint32_t instances = 0;
+	uint32_t triangles = 0;
+	uint32_t submits = 0;
+	uint32_t program_switches = 0;
+	uint32_t texture_switches = 0;
+	uint32_t vao_switches = 0;
+};
+
 struct GLTFRenderQueue {
 public:
+	// how opaque draws are ordered inside a state bucket
+	enum OpaqueOrder {
+		OO_STATE,          // by primitive, for the longest instanced runs
+		OO_FRONT_TO_BACK,  // nearest command first
+		OO_DEPTH_PREPASS,  // front to back, after a depth-only pass
+	};
+
 	static GLTFRenderQueue* getInstance();
-	void render();
-	void push(GLTFRenderRequest&& request);
+	static const char* opaque_order_name(OpaqueOrder order);
+	// sorts list in place and submits it, occlusion culled if occlusion is ready
+	void render(GLTFScene* scene, GLTFDrawList& list, HiZCuller* occlusion = nullptr);
+	void end_frame();
+	void print_stats(std::ostream& os) const;
+
+	// per-frame model matrices and draw commands; the model matrices are bound
+	// to Material::MODEL_LOCATION with a divisor of 1 in the geometry pool VAO
+	DynamicBuffer& stream_buffer();
+
+	bool sort_opaque = true;
+	bool instancing = true;
+	OpaqueOrder opaque_order = OO_FRONT_TO_BACK;
+	// depth-only material for OO_DEPTH_PREPASS; its vertex shader must
+	// produce the same gl_Position as every opaque material's
+	std::shared_ptr<Material> depth_prepass_material;
+	// last finished frame, in push order and in submission order
+	RenderStats unsorted_stats, sorted_stats;
 private:
-	explicit GLTFRenderQueue() = default;
-	static inline GLTFRenderQueue *instance = nullptr;
-	std::deque<GLTFRenderRequest> opaque_queue;
-	std::deque<GLTFRenderRequest> blend_queue;
-};
+	struct DrawState {
+		GLuint program = 0, texture = 0, vao = 0;
+	};
+
+	// commands sharing a material, mode and index type, issued by one
+	// multi-draw
+	struct DrawBatch {
+		uint32_t record;
+		uint32_t first_command;
+		uint32_t command_count;
+		GLenum mode;
+		GLenum index_type;
+		// back faces culled: the view culls them and the material is single-sided
+		bool cull;
+	};
+
+	struct DepthSortedCommand {
+		float z;
+		uint32_t primitive;
+		uint32_t meshlet;
+		DrawElementsIndirectCommand command;
+	};
 
-struct GLTFBufferView {
-	GLuint handle;
-	tinygltf::BufferView &bufv;
+	static constexpr uint32_t NO_MESHLET = UINT32_MAX;
 
-	GLTFBufferView(tinygltf::BufferView& view, tinygltf::Buffer& buffer);
-	void bind();
+	explicit GLTFRenderQueue() = default;
+	Material* material_of(const GLTFDrawRecord& record) const;
+	uint32_t upload_instances();
+	void build_batches(FrameArena<GLTFDrawRecord>& records, uint32_t base_instance);
+	void sort_front_to_back(size_t first_batch, size_t last_batch);
+	size_t upload_commands();
+	size_t upload_command_bounds();
+	void cull_meshlets(size_t command_offset);
+	void depth_prepass(size_t last_batch, size_t command_offset);
+	void submit(FrameArena<GLTFDrawRecord>& records, size_t first_batch, size_t last_batch, size_t command_offset, DrawState& state);
+	void count_switches(const GLTFDrawRecord& record, DrawState& state, RenderStats& stats) const;
+
+	static inline GLTFRenderQueue *instance = nullptr;
+	GLTFScene* scene = nullptr;
+	GLTFDrawList* list = nullptr;
+	std::unique_ptr<DynamicBuffer> stream;
+	FrameArena<glm::mat4> instance_transforms;
+	FrameArena<GLTFDrawRecord> sort_scratch;
+	FrameArena<DrawElementsIndirectCommand> commands;
+	// nearest depth of each command, parallel to commands
+	FrameArena<float> command_z;
+	FrameArena<uint32_t> command_primitive;
+	// index into the scene's meshlet table of each command, or NO_MESHLET
+	FrameArena<uint32_t> command_meshlet;
+	// (command, meshlet) of every meshlet command, for MeshletCuller
+	FrameArena<glm::uvec2> meshlet_jobs;
+	bool expand_meshlets = false;
+	// min and max of each command's primitive in the space of the uploaded
+	// positions, for HiZCuller
+	FrameArena<glm::vec4> command_bounds;
+	FrameArena<DepthSortedCommand> command_scratch;
+	FrameArena<DrawBatch> batches;
+	RenderStats frame_unsorted_stats, frame_sorted_stats;
 };
 
 struct GLTFPrimitive {
-	std::shared_ptr<Material> default_material = nullptr;
+	// LODs per primitive, including the original; the sort key has 2 bits
+	static constexpr size_t MAX_LODS = 4;
+	// smaller triangle lists are not simplified
+	static constexpr uint32_t MIN_LOD_TRIANGLES = 256;
+	// largest error of one simplification step, relative to the extent
+	static constexpr float MAX_LOD_ERROR = 0.05f;
+	// smaller triangle lists are drawn whole, a few meshlets gain nothing
+	static constexpr uint32_t MIN_MESHLET_TRIANGLES = 8 * Meshlet::MAX_TRIANGLES;
+
+	uint32_t index;
+	uint32_t material_index;
 	GLuint mode;
-	std::shared_ptr<GLTFBufferView> index_bufv, pos_bufv, normal_bufv, texcoord_bufv;
-	tinygltf::Accessor* pos_acc;
-	tinygltf::Accessor* normal_acc;
-	tinygltf::Accessor* texcoord_acc;
-	tinygltf::Accessor* index_acc;
-	GLuint vao;
+	// lods[0] is the original geometry, coarser levels follow
+	std::vector<GeometryLod> lods;
+	// clusters of lods[0], whose indices they reorder; empty if not clustered
+	std::vector<Meshlet> meshlets;
+	// index of meshlets[0] in the scene's meshlet table
+	uint32_t first_meshlet = 0;
+	AABB bounds;
+	// maps the uploaded, possibly quantized, positions to local space; bounds
+	// in the space of the uploaded positions
+	glm::mat4 dequantization = glm::mat4(1.0f);
+	AABB vertex_bounds;
 
+	GLTFPrimitive() = default;
 	GLTFPrimitive(tinygltf::Model& model, tinygltf::Primitive& primitive, GLTFScene* scene);
-	void draw(const Camera& cam, glm::mat4& transform, std::shared_ptr<Material> material = nullptr);
+	DrawElementsIndirectCommand command(uint8_t lod, uint32_t instance_count, uint32_t base_instance) const;
+	DrawElementsIndirectCommand meshlet_command(size_t meshlet, uint32_t base_instance) const;
 };
 
 struct GLTFMesh {
 	std::vector<std::shared_ptr<GLTFPrimitive>> primitives;
 
+	GLTFMesh() = default;
 	GLTFMesh(tinygltf::Model& model, tinygltf::Mesh& mesh, GLTFScene* scene);
-	void draw(const Camera& cam, glm::mat4& transform, std::shared_ptr<Material> material = nullptr);
+};
+
+// One primitive of one drawn node instance, the unit of culling. Kept as
+// SoA so the culler streams through the bounds only.
+struct GLTFDrawItems {
+	std::vector<uint32_t> primitive;
+	std::vector<uint32_t> node;  // flat scene graph node
+	std::vector<int32_t> instance;  // into the node's gpu instances, -1 if none
+	std::vector<glm::mat4> transform;  // world
+	// set once the item's node moved on its own; static items never have
+	std::vector<uint8_t> dynamic;
+	BoundsSoA bounds;
+
+	size_t size() const {
+		return primitive.size();
+	}
 };
 
 struct GLTFScene {
 
+	// empty, to be filled by parse() and init() or by a SceneStreamer
+	GLTFScene() = default;
+	// parses filename and decodes its images on the ThreadPool
 	GLTFScene(const std::string& filename);
 
+	// parses filename into model, leaving its images encoded in images
+	bool parse(const std::string& filename, DeferredImageLoader& images);
 	void init(std::shared_ptr<ShaderProgram> shader_program, std::shared_ptr<PointLight> light, std::shared_ptr<Texture> shadow_map = nullptr);
-	void render(const Camera& cam, std::shared_ptr<Material> material = nullptr);
-	void draw_node(tinygltf::Node& node, const Camera& cam, glm::mat4& transform, std::shared_ptr<Material> material = nullptr);
+	// init() in stages, which SceneStreamer runs as their inputs arrive.
+	// Materials need the GL context; with placeholders their textures are
+	// 1x1 white until the images are decoded and given to Texture::set_image.
+	void init_materials(std::shared_ptr<ShaderProgram> shader_program, std::shared_ptr<PointLight> light,
+		std::shared_ptr<Texture> shadow_map, bool placeholders);
+	// meshes, LODs, meshlets and instances on the CPU; touches no GL state,
+	// so it may run on another thread
+	void build_geometry();
+	// uploads what build_geometry() made and creates the draw items, after
+	// which the scene can be drawn
+	void upload_geometry();
+	// upload_geometry() with the vertices and indices sent in parts of at
+	// most max_bytes, see GeometryPool::upload_part(); true after the last
+	bool upload_geometry_part(size_t max_bytes);
+	// drops the decoded images and raw buffers of model, which then only
+	// holds metadata; its accessors can no longer be read
+	void release_model_payloads();
+	// applies node and scene transform changes to the draw items, call once
+	// per frame before build
+	void update();
+	// fills the draw list of every view; the draw items are split into BVH
+	// subtrees, or ranges without culling, that are culled on the ThreadPool,
+	// all views at once
+	void build(GLTFView* views, size_t view_count);
+	void render(GLTFView& view);
 	void update_matrix(glm::mat4&& mat);
+	size_t dynamic_items() const {
+		return dynamic_count;
+	}
+	// LODs change what the static shadow layer draws, so it is redrawn
+	void set_lod_bias(bool enable, float bias) {
+		use_lods = enable;
+		lod_bias = bias;
+		static_version += 1;
+	}
+	// nearest draw item whose world bounds the ray hits, or -1; t is the
+	// distance along dir
+	int64_t pick(const glm::vec3& origin, const glm::vec3& dir, float& t) const;
+	// times BVH build, refit and queries against the linear cull
+	void benchmark_bvh(const Camera& cam, std::ostream& os);
 
 	tinygltf::Model model;
 	std::string err;
 	std::string warn;
 	std::vector<std::shared_ptr<Texture>> textures;
 	std::vector<std::shared_ptr<Material>> materials;
-	std::vector<std::shared_ptr<GLTFBufferView>> bufferViews;
+	GeometryPool geometry;
 	std::vector <std::shared_ptr<GLTFMesh>> meshes;
+	std::vector<std::shared_ptr<GLTFPrimitive>> primitives;
+	// per node, the EXT_mesh_gpu_instancing transforms; empty if not instanced
+	std::vector<std::vector<glm::mat4>> node_instances;
+	SceneGraph graph;
+	GLTFDrawItems items;
+	// over items.bounds, rebuilt with the items and refit when nodes move
+	BVH bvh;
 	glm::mat4 matrix = glm::mat4(1.0);
+	bool frustum_culling = true;
+	// weld and reorder triangle lists at init(), see GeometryPool::optimize
+	bool optimize_geometry = true;
+	// upload 16 byte vertices at init(), see GeometryPool::quantize
+	bool quantize_vertices = true;
+	// release_model_payloads() at the end of init()
+	bool release_payloads = true;
+	// simplify primitives at init(); off keeps every primitive at one LOD
+	bool generate_lods = true;
+	// cluster large primitives into meshlets at init()
+	bool generate_meshlets = true;
+	// culls the meshlets of views with GLTFView::meshlet_culling; null
+	// without meshlets
+	std::unique_ptr<MeshletCuller> meshlet_culler;
+	// at bias 0, a LOD is used while its error projects to at most
+	// lod_pixel_error pixels; every step of bias doubles that. Change
+	// use_lods and lod_bias through set_lod_bias.
+	bool use_lods = true;
+	float lod_bias = .0f;
+	float lod_pixel_error = 1.0f;
+	// bumped whenever a static item moves, so layers of static items cached
+	// elsewhere, like the static shadow map, know to redraw
+	uint64_t static_version = 0;
+
+private:
+	friend struct SceneCache;
+
+	void load_instances();
+	// the rest of upload_geometry() once the geometry pool is on the GPU
+	void finish_geometry();
+	// gives the meshlets of every primitive their place in the culler's table
+	void upload_meshlets();
+	// draw items for graph, which must be built
+	void create_items();
+	void build_items();
+	// recomputes transforms and bounds of the items whose node moved
+	void update_items(bool all);
+	// culls items [first, last) and pushes the visible ones
+	void cull_range(size_t first, size_t last, const GLTFView& view, GLTFDrawList& list) const;
+	// culls the items below BVH node root and pushes the visible ones
+	void cull_subtree(uint32_t root, const GLTFView& view, GLTFDrawList& list) const;
+	uint8_t select_lod(size_t item, const GLTFView& view) const;
+	bool in_layer(size_t item, CasterLayer layer) const {
+		return layer == CL_ALL || items.dynamic[item] == (layer == CL_DYNAMIC);
+	}
+	// items whose node moved but not the whole scene become dynamic
+	void promote_moved_items();
+
+	// one per view and task, merged into the views' lists
+	std::vector<GLTFDrawList> task_lists;
+	// BVH subtrees culled as one task each
+	std::vector<uint32_t> task_roots;
+	bool items_valid = false;
+	bool matrix_changed = false;
+	size_t dynamic_count = 0;
 };
 
 //// GLTFScene
 GLTFScene::GLTFScene(const std::string& filename) {
-	tinygltf::TinyGLTF loader;
-	stbi_set_flip_vertically_on_load(false);
-	// bool result = loader.LoadASCIIFromFile(&model, &err, &warn, filename);
-	bool result = false;
-	if (filename.ends_with(".gltf")) {
-		result = loader.LoadASCIIFromFile(&model, &err, &warn, filename);
-	} else if (filename.ends_with(".glb")) {
-		result = loader.LoadBinaryFromFile(&model, &err, &warn, filename);
+	using clock = std::chrono::high_resolution_clock;
+	DeferredImageLoader images;
+	auto start = clock::now();
+	bool result = parse(filename, images);
+	auto parsed = clock::now();
+	if (result) {
+		result = images.decode(model, err);
+		std::cout << "loaded " << filename << ": parse "
+			<< std::chrono::duration<double, std::milli>(parsed - start).count() << " ms, " << images.pending.size()
+			<< " images decoded in " << std::chrono::duration<double, std::milli>(clock::now() - parsed).count()
+			<< " ms on " << ThreadPool::getInstance()->concurrency() << " threads" << std::endl;
+		if (!err.empty()) {
+			std::cerr << err << std::endl;
+		}
 	}
+}
+
+bool GLTFScene::parse(const std::string& filename, DeferredImageLoader& images) {
+	tinygltf::TinyGLTF loader;
+	bool result = load_gltf_file(loader, images, model, err, warn, filename);
 
 	if (!warn.empty()) {
 		std::cerr << warn << std::endl;
@@ -111,19 +411,42 @@ GLTFScene::GLTFScene(const std::string& filename) {
 	if (!result) {
 		std::cerr << "failed to load model " << filename << std::endl;
 	}
+	// KHR_mesh_quantization only widens the accessor types, which
+	// read_accessor_floats decodes before GeometryPool quantizes them again
+	for (const std::string& extension : model.extensionsRequired) {
+		if (extension != "KHR_mesh_quantization" && extension != "EXT_mesh_gpu_instancing") {
+			std::cerr << "unsupported required extension: " << extension << std::endl;
+		}
+	}
+	warn.clear();
+	err.clear();
+	return result;
 }
 
 void GLTFScene::init(std::shared_ptr<ShaderProgram> shader_program, std::shared_ptr<PointLight> light, std::shared_ptr<Texture> shadow_map) {
-	tinygltf::Scene scene = model.scenes[model.defaultScene];
-	
+	init_materials(shader_program, light, shadow_map, false);
+	build_geometry();
+	upload_geometry();
+	if (release_payloads) {
+		release_model_payloads();
+	}
+}
+
+void GLTFScene::init_materials(std::shared_ptr<ShaderProgram> shader_program, std::shared_ptr<PointLight> light,
+	std::shared_ptr<Texture> shadow_map, bool placeholders) {
 	for (tinygltf::Texture& texture : model.textures) {
 		std::cout << "loading texture: " << texture.name << std::endl;
 		tinygltf::Image& image = model.images[texture.source];
 		tinygltf::Sampler& sampler = model.samplers[texture.sampler];
 
-		std::cout << "image: " << image.name << ", " << image.width << ", " << image.height << ", " << image.image.size() << std::endl;
-
-		auto my_texture = std::make_shared<Texture>(image.image, image.width, image.height, sampler.wrapS, sampler.wrapT, sampler.minFilter, sampler.magFilter, image.pixel_type);
+		std::shared_ptr<Texture> my_texture;
+		if (placeholders) {
+			my_texture = std::make_shared<Texture>(std::vector<unsigned char>{ 255, 255, 255, 255 }, 1, 1,
+				sampler.wrapS, sampler.wrapT, sampler.minFilter, sampler.magFilter);
+		} else {
+			std::cout << "image: " << image.name << ", " << image.width << ", " << image.height << ", " << image.image.size() << std::endl;
+			my_texture = std::make_shared<Texture>(image.image, image.width, image.height, sampler.wrapS, sampler.wrapT, sampler.minFilter, sampler.magFilter, image.pixel_type);
+		}
 
 		textures.push_back(my_texture);
 	}
@@ -142,192 +465,526 @@ void GLTFScene::init(std::shared_ptr<ShaderProgram> shader_program, std::shared_
 		std::cout << "load material: " << mat.name << std::endl;
 
 		auto my_material = std::make_shared<PhongMaterial>(shader_program, texture, light, shadow_map, alpha_mode);
+		my_material->double_sided = mat.doubleSided;
 		materials.push_back(my_material);
 	}
+}
 
-	for (tinygltf::BufferView& view : model.bufferViews) {
-		auto buf = std::make_shared<GLTFBufferView>(view, model.buffers[view.buffer]);
-		std::cout << "load bufferview: " << model.buffers[view.buffer].data.size() << ", uri: " << model.buffers[view.buffer].uri << ", offset: " << view.byteOffset << std::endl;
-		bufferViews.push_back(buf);
-	}
-
+void GLTFScene::build_geometry() {
+	geometry.optimize = optimize_geometry;
+	geometry.quantize = quantize_vertices;
 	for (tinygltf::Mesh& mesh : model.meshes) {
 		auto my_mesh = std::make_shared<GLTFMesh>(model, mesh, this);
 		std::cout << "load mesh: " << mesh.name << std::endl;
 		meshes.push_back(my_mesh);
 	}
+	load_instances();
+}
+
+void GLTFScene::upload_geometry() {
+	geometry.upload();
+	finish_geometry();
 }
 
-void GLTFScene::render(const Camera& cam, std::shared_ptr<Material> material) {
-	tinygltf::Scene scene = model.scenes[model.defaultScene];
-	for (int node : scene.nodes) {
-		tinygltf::Node& n = model.nodes[node];
-		draw_node(n, cam, matrix, material);
+bool GLTFScene::upload_geometry_part(size_t max_bytes) {
+	if (!geometry.upload_part(max_bytes)) {
+		return false;
 	}
-	auto request_queue = GLTFRenderQueue::getInstance();
-	request_queue->render();
+	finish_geometry();
+	return true;
 }
 
-void GLTFScene::draw_node(tinygltf::Node& node, const Camera& cam, glm::mat4& transform, std::shared_ptr<Material> material) {
-	// std::vector<float> temp;
-	glm::mat4 matrix(1.0f);
+void GLTFScene::finish_geometry() {
+	size_t lod_primitives = std::count_if(primitives.begin(), primitives.end(), [](const auto& prim) {
+		return prim->lods.size() > 1;
+	});
+	std::cout << "lods: " << lod_primitives << " of " << primitives.size() << " primitives simplified" << std::endl;
+	upload_meshlets();
+	graph.build(model, std::max(model.defaultScene, 0));
+	create_items();
+}
 
-	if (node.matrix.size() == 16) {
-		matrix = glm::make_mat4(node.matrix.data());
-	} else {
-		if (node.scale.size() == 3) {
-			glm::mat4 scale = glm::scale(glm::mat4(1.0), glm::vec3(node.scale[0], node.scale[1], node.scale[2]));
-			matrix = scale * matrix;
+void GLTFScene::upload_meshlets() {
+	std::vector<Meshlet> meshlet_table;
+	for (const auto& prim : primitives) {
+		prim->first_meshlet = static_cast<uint32_t>(meshlet_table.size());
+		// the GPU sees the meshlets in the space of the uploaded positions
+		const glm::vec4& dequantize = prim->lods[0].range.dequantize;
+		// both faces of a double-sided material are seen, so its cones cull nothing
+		bool double_sided = prim->material_index < model.materials.size() && model.materials[prim->material_index].doubleSided;
+		for (Meshlet meshlet : prim->meshlets) {
+			meshlet.sphere = glm::vec4((glm::vec3(meshlet.sphere) - glm::vec3(dequantize)) / dequantize.w, meshlet.sphere.w / dequantize.w);
+			if (double_sided) {
+				meshlet.cone.w = 1.0f;
+			}
+			meshlet_table.push_back(meshlet);
 		}
-		if (node.rotation.size() == 4) {
-			glm::quat qua(node.rotation[3], node.rotation[0], node.rotation[1], node.rotation[2]);
-			glm::mat4 rotate = glm::mat4_cast(qua);
-			matrix = rotate * matrix;
+	}
+	if (!meshlet_table.empty()) {
+		meshlet_culler = std::make_unique<MeshletCuller>();
+		meshlet_culler->upload(meshlet_table);
+	}
+}
+
+void GLTFScene::create_items() {
+	graph.set_root_transform(matrix);
+	build_items();
+	std::cout << "scene graph: " << graph.size() << " nodes, " << graph.drawables.size() << " with meshes, "
+		<< items.size() << " draw items" << std::endl;
+}
+
+// Everything read from the images and buffers lives on the GPU or in the
+// renderer's own structures by now
+void GLTFScene::release_model_payloads() {
+	ProcessMemory before = ProcessMemory::query();
+	size_t released = 0;
+	for (tinygltf::Image& image : model.images) {
+		released += image.image.capacity();
+		std::vector<unsigned char>().swap(image.image);
+	}
+	for (tinygltf::Buffer& buffer : model.buffers) {
+		released += buffer.data.capacity();
+		std::vector<unsigned char>().swap(buffer.data);
+	}
+	ProcessMemory after = ProcessMemory::query();
+	std::cout << "released " << released / 1024 << " KiB of image and buffer data, ";
+	before.print(std::cout);
+	std::cout << " before, ";
+	after.print(std::cout);
+	std::cout << " after" << std::endl;
+}
+
+void GLTFScene::build_items() {
+	items = GLTFDrawItems{};
+	for (uint32_t i : graph.drawables) {
+		const GLTFMesh& mesh = *meshes[graph.mesh[i]];
+		int32_t instance_count = static_cast<int32_t>(node_instances[graph.node[i]].size());
+		for (int32_t instance = instance_count > 0 ? 0 : -1; instance < instance_count; ++instance) {
+			for (const auto& prim : mesh.primitives) {
+				items.primitive.push_back(prim->index);
+				items.node.push_back(i);
+				items.instance.push_back(instance);
+			}
 		}
-		if (node.translation.size() == 3) {
-			glm::mat4 translate = glm::translate(glm::mat4(1.0), glm::vec3(node.translation[0], node.translation[1], node.translation[2]));
-			matrix = translate * matrix;
+	}
+	items.transform.resize(items.size());
+	items.dynamic.assign(items.size(), 0);
+	items.bounds.resize(items.size());
+	items_valid = false;
+	dynamic_count = 0;
+}
+
+void GLTFScene::update_items(bool all) {
+	const size_t CHUNK = 1024;
+	ThreadPool::getInstance()->parallel_for((items.size() + CHUNK - 1) / CHUNK, [&](size_t chunk) {
+		size_t last = std::min(items.size(), (chunk + 1) * CHUNK);
+		for (size_t k = chunk * CHUNK; k < last; ++k) {
+			uint32_t node = items.node[k];
+			if (!all && !graph.changed[node]) {
+				continue;
+			}
+			glm::mat4 transform = graph.world[node];
+			if (items.instance[k] >= 0) {
+				transform = transform * node_instances[graph.node[node]][items.instance[k]];
+			}
+			const AABB& local = primitives[items.primitive[k]]->bounds;
+			items.transform[k] = transform;
+			items.bounds.set(k, local.transformed(transform), BoundingSphere::around(local, transform).radius);
 		}
+	});
+}
+
+void GLTFScene::load_instances() {
+	node_instances.resize(model.nodes.size());
+	for (size_t i = 0; i < model.nodes.size(); ++i) {
+		const tinygltf::Node& node = model.nodes[i];
+		auto ext = node.extensions.find("EXT_mesh_gpu_instancing");
+		if (ext == node.extensions.end() || !ext->second.Has("attributes")) {
+			continue;
+		}
+		const tinygltf::Value& attributes = ext->second.Get("attributes");
+		std::vector<float> translation, rotation, scale;
+		size_t count = 0;
+		auto read = [&](const char* name, std::vector<float>& out) {
+			if (attributes.Has(name)) {
+				const tinygltf::Accessor& acc = model.accessors[attributes.Get(name).GetNumberAsInt()];
+				out = read_accessor_floats(model, acc);
+				count = acc.count;
+			}
+		};
+		read("TRANSLATION", translation);
+		read("ROTATION", rotation);
+		read("SCALE", scale);
+
+		auto& instances = node_instances[i];
+		instances.reserve(count);
+		for (size_t j = 0; j < count; ++j) {
+			glm::mat4 matrix(1.0f);
+			if (!translation.empty()) {
+				matrix = glm::translate(matrix, glm::vec3(translation[j * 3], translation[j * 3 + 1], translation[j * 3 + 2]));
+			}
+			if (!rotation.empty()) {
+				glm::quat qua(rotation[j * 4 + 3], rotation[j * 4], rotation[j * 4 + 1], rotation[j * 4 + 2]);
+				matrix = matrix * glm::mat4_cast(qua);
+			}
+			if (!scale.empty()) {
+				matrix = glm::scale(matrix, glm::vec3(scale[j * 3], scale[j * 3 + 1], scale[j * 3 + 2]));
+			}
+			instances.push_back(matrix);
+		}
+		std::cout << "node " << node.name << ": " << count << " gpu instances" << std::endl;
 	}
-	glm::mat4 real_transform = transform * matrix;
+}
 
-	if (node.mesh != -1) {
-		auto mesh_ref = meshes[node.mesh];
-		mesh_ref->draw(cam, real_transform, material);
-		return;
+void GLTFScene::update() {
+	graph.update();
+	if (!items_valid) {
+		update_items(true);
+		bvh.build(items.bounds);
+		items_valid = true;
+		static_version += 1;
+	} else if (graph.last_updated > 0) {
+		update_items(false);
+		bvh.refit(items.bounds);
+		if (matrix_changed) {
+			static_version += 1;
+		} else {
+			promote_moved_items();
+		}
+	}
+	matrix_changed = false;
+}
+
+void GLTFScene::promote_moved_items() {
+	bool promoted = false;
+	for (size_t k = 0; k < items.size(); ++k) {
+		if (!items.dynamic[k] && graph.changed[items.node[k]]) {
+			items.dynamic[k] = 1;
+			dynamic_count += 1;
+			promoted = true;
+		}
 	}
-	
-	for (int child : node.children) {
-		tinygltf::Node& next_node = model.nodes[child];
-		draw_node(next_node, cam, real_transform, material);
+	if (promoted) {
+		static_version += 1;
 	}
 }
 
-void GLTFScene::update_matrix(glm::mat4&& transform) {
-	matrix = transform;
+void GLTFScene::build(GLTFView* views, size_t view_count) {
+
+	auto* pool = ThreadPool::getInstance();
+	size_t item_count = items.size();
+	size_t task_count = std::max<size_t>(1, std::min(item_count, pool->concurrency() * 4));
+	bool hierarchical = frustum_culling && !bvh.empty();
+	if (hierarchical) {
+		bvh.subtrees(task_count, task_roots);
+		task_count = task_roots.size();
+	}
+	if (task_lists.size() < view_count * task_count) {
+		task_lists.resize(view_count * task_count);
+	}
+
+	pool->parallel_for(view_count * task_count, [&](size_t job) {
+		GLTFView& view = views[job / task_count];
+		size_t task = job % task_count;
+		GLTFDrawList& list = task_lists[job];
+		list.reset(view.override_material.get());
+		if (view.layer == CL_DYNAMIC && dynamic_count == 0) {
+			return;
+		}
+		if (hierarchical) {
+			cull_subtree(task_roots[task], view, list);
+		} else {
+			cull_range(item_count * task / task_count, item_count * (task + 1) / task_count, view, list);
+		}
+	});
+
+	// merged in task order, so the result does not depend on scheduling
+	pool->parallel_for(view_count, [&](size_t v) {
+		GLTFDrawList& list = views[v].list;
+		list.reset(views[v].override_material.get());
+		for (size_t t = 0; t < task_count; ++t) {
+			list.append(task_lists[v * task_count + t]);
+		}
+		// items below rejected BVH nodes were never visited, but count as tested
+		if (hierarchical) {
+			list.tested = static_cast<uint32_t>(item_count);
+		}
+		list.meshlet_culling = views[v].meshlet_culling;
+		list.cull_back_faces = views[v].cull_back_faces;
+		list.frustum = Frustum::from_matrix(views[v].cam.project() * views[v].cam.view());
+		list.eye = views[v].cam.pos;
+	});
+}
+
+void GLTFScene::render(GLTFView& view) {
+	GLTFRenderQueue::getInstance()->render(this, view.list, view.occlusion);
+}
+
+void GLTFScene::cull_range(size_t first, size_t last, const GLTFView& view, GLTFDrawList& list) const {
+	const size_t BLOCK = 256;
+	uint8_t visible[BLOCK];
+	glm::mat4 vp = view.cam.project() * view.cam.view();
+	Frustum frustum = Frustum::from_matrix(vp);
+	for (size_t block = first; block < last; block += BLOCK) {
+		size_t count = std::min(BLOCK, last - block);
+		if (frustum_culling) {
+			cull_bounds(frustum, items.bounds, block, count, visible);
+		} else {
+			std::fill(visible, visible + count, 1);
+		}
+		list.tested += static_cast<uint32_t>(count);
+		for (size_t k = 0; k < count; ++k) {
+			size_t i = block + k;
+			if (!visible[k] || !in_layer(i, view.layer)) {
+				continue;
+			}
+			glm::vec4 pos = vp * glm::vec4(items.bounds.center_x[i], items.bounds.center_y[i], items.bounds.center_z[i], 1.0f);
+			list.push(*this, items.primitive[i], items.transform[i], pos.z / pos.w, select_lod(i, view));
+			list.visible += 1;
+		}
+	}
+}
+
+void GLTFScene::cull_subtree(uint32_t root, const GLTFView& view, GLTFDrawList& list) const {
+	glm::mat4 vp = view.cam.project() * view.cam.view();
+	Frustum frustum = Frustum::from_matrix(vp);
+	bvh.cull(frustum, root, [&](uint32_t i, bool inside) {
+		list.tested += 1;
+		if (!in_layer(i, view.layer) || (!inside && !bounds_visible(frustum, items.bounds, i))) {
+			return;
+		}
+		glm::vec4 pos = vp * glm::vec4(items.bounds.center_x[i], items.bounds.center_y[i], items.bounds.center_z[i], 1.0f);
+		list.push(*this, items.primitive[i], items.transform[i], pos.z / pos.w, select_lod(i, view));
+		list.visible += 1;
+	});
+}
+
+// The coarsest LOD whose error, scaled by the projected diameter of the
+// item's bounding sphere, stays within the pixel tolerance
+uint8_t GLTFScene::select_lod(size_t item, const GLTFView& view) const {
+	const GLTFPrimitive& prim = *primitives[items.primitive[item]];
+	if (!use_lods || prim.lods.size() < 2) {
+		return 0;
+	}
+	glm::vec3 center(items.bounds.center_x[item], items.bounds.center_y[item], items.bounds.center_z[item]);
+	float radius = items.bounds.radius[item];
+	float distance = glm::length(center - view.cam.pos);
+	if (distance <= radius) {
+		return 0;
+	}
+	float pixels = radius / (distance * std::tan(view.cam.fovy * 0.5f)) * view.viewport_height;
+	float tolerance = lod_pixel_error * std::exp2(lod_bias + view.lod_bias);
+	uint8_t lod = 0;
+	while (lod + 1u < prim.lods.size() && prim.lods[lod + 1].error * pixels <= tolerance) {
+		++lod;
+	}
+	return lod;
+}
+
+int64_t GLTFScene::pick(const glm::vec3& origin, const glm::vec3& dir, float& t) const {
+	glm::vec3 inv_dir = 1.0f / dir;
+	return bvh.raycast(origin, dir, [&](uint32_t i, float t_max) {
+		return BVH::ray_box(items.bounds.aabb(i), origin, inv_dir, t_max);
+	}, t);
 }
 
-//// GLTFBufferView
-GLTFBufferView::GLTFBufferView(tinygltf::BufferView& view, tinygltf::Buffer& buffer) : bufv(view) {
-	glGenBuffers(1, &handle);
-	glBindBuffer(view.target, handle);
+void GLTFScene::benchmark_bvh(const Camera& cam, std::ostream& os) {
+	const int REPEATS = 20;
+	const int RAYS = 10000;
+	size_t n = items.size();
+	BVH built;
+	double build_ms = average_ms(REPEATS, [&] { built.build(items.bounds); });
+	double refit_ms = average_ms(REPEATS, [&] { built.refit(items.bounds); });
+
+	Frustum frustum = Frustum::from_matrix(cam.project() * cam.view());
+	std::vector<uint8_t> visible(n);
+	size_t linear_visible = 0, bvh_visible = 0;
+	double linear_ms = average_ms(REPEATS, [&] {
+		cull_bounds(frustum, items.bounds, 0, n, visible.data());
+		linear_visible = std::count(visible.begin(), visible.end(), 1);
+	});
+	double cull_ms = average_ms(REPEATS, [&] {
+		bvh_visible = 0;
+		built.cull(frustum, 0, [&](uint32_t i, bool inside) {
+			bvh_visible += inside || bounds_visible(frustum, items.bounds, i);
+		});
+	});
+
+	// rays from the camera through a grid over the screen
+	glm::mat4 inv_vp = glm::inverse(cam.project() * cam.view());
+	int side = static_cast<int>(std::sqrt(RAYS));
+	std::vector<glm::vec3> dirs;
+	dirs.reserve(side * side);
+	for (int y = 0; y < side; ++y) {
+		for (int x = 0; x < side; ++x) {
+			glm::vec4 p = inv_vp * glm::vec4((x + 0.5f) / side * 2.0f - 1.0f, (y + 0.5f) / side * 2.0f - 1.0f, 1.0f, 1.0f);
+			dirs.push_back(glm::normalize(glm::vec3(p) / p.w - cam.pos));
+		}
+	}
+	size_t hits = 0;
+	double ray_ms = average_ms(REPEATS, [&] {
+		hits = 0;
+		float t;
+		for (const glm::vec3& dir : dirs) {
+			hits += pick(cam.pos, dir, t) >= 0;
+		}
+	});
+
+	size_t overlaps = 0;
+	double overlap_ms = average_ms(REPEATS, [&] {
+		overlaps = 0;
+		for (size_t i = 0; i < n; i += std::max<size_t>(1, n / 256)) {
+			built.overlap(BoundingSphere{ glm::vec3(items.bounds.center_x[i], items.bounds.center_y[i], items.bounds.center_z[i]), items.bounds.radius[i] },
+				items.bounds, [&](uint32_t) { overlaps += 1; });
+		}
+	});
 
-	glBufferData(view.target, view.byteLength, buffer.data.data() + view.byteOffset, GL_STATIC_DRAW);
+	os << "bvh: " << n << " items, " << built.nodes.size() << " nodes, build " << build_ms << " ms, refit " << refit_ms << " ms" << std::endl;
+	os << "bvh cull: " << cull_ms << " ms (" << bvh_visible << " visible), linear cull: " << linear_ms << " ms (" << linear_visible << " visible)" << std::endl;
+	os << "bvh raycast: " << dirs.size() << " rays in " << ray_ms << " ms (" << hits << " hits), "
+		<< overlaps << " sphere overlaps in " << overlap_ms << " ms" << std::endl;
 }
 
-void GLTFBufferView::bind() {
-	glBindBuffer(bufv.target, handle);
+void GLTFScene::update_matrix(glm::mat4&& transform) {
+	matrix = transform;
+	graph.set_root_transform(matrix);
+	matrix_changed = true;
 }
 
 //// GLTFPrimitive
 GLTFPrimitive::GLTFPrimitive(tinygltf::Model& model, tinygltf::Primitive& primitive, GLTFScene* scene) {
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
+	mode = primitive.mode;
+	material_index = primitive.material;
+	GeometryRange range = scene->geometry.add(model, primitive);
+	if (scene->generate_lods && mode == TINYGLTF_MODE_TRIANGLES && range.index_count / 3 >= MIN_LOD_TRIANGLES) {
+		scene->geometry.add_lods(range, MAX_LODS, MAX_LOD_ERROR, lods);
+	} else {
+		lods = { GeometryLod{ range, .0f } };
+	}
+	if (scene->generate_meshlets && mode == TINYGLTF_MODE_TRIANGLES && range.index_count / 3 >= MIN_MESHLET_TRIANGLES) {
+		scene->geometry.add_meshlets(range, meshlets);
+	}
 
-	// std::cout << "vao: " << vao << std::endl;
+	// accessor min/max are required for POSITION, but only trusted for floats
+	auto it = primitive.attributes.find("POSITION");
+	if (it != primitive.attributes.end()) {
+		const tinygltf::Accessor& acc = model.accessors[it->second];
+		if (acc.componentType == TINYGLTF_COMPONENT_TYPE_FLOAT && acc.minValues.size() == 3 && acc.maxValues.size() == 3) {
+			bounds = AABB{
+				glm::vec3(acc.minValues[0], acc.minValues[1], acc.minValues[2]),
+				glm::vec3(acc.maxValues[0], acc.maxValues[1], acc.maxValues[2]),
+			};
+		} else {
+			std::vector<float> positions = read_accessor_floats(model, acc);
+			for (size_t i = 0; i + 2 < positions.size(); i += 3) {
+				bounds.expand(glm::vec3(positions[i], positions[i + 1], positions[i + 2]));
+			}
+		}
+	}
+	if (bounds.empty()) {
+		bounds = AABB{ glm::vec3(.0f), glm::vec3(.0f) };
+	}
+	const glm::vec4& dequantize = lods[0].range.dequantize;
+	dequantization = lods[0].range.dequantization();
+	vertex_bounds = AABB{
+		(bounds.min - glm::vec3(dequantize)) / dequantize.w,
+		(bounds.max - glm::vec3(dequantize)) / dequantize.w,
+	};
+}
 
-	pos_acc = &model.accessors[primitive.attributes["POSITION"]];
-	normal_acc = &model.accessors[primitive.attributes["NORMAL"]];
-	texcoord_acc = &model.accessors[primitive.attributes["TEXCOORD_0"]];
-	index_acc = &model.accessors[primitive.indices];
-	mode = primitive.mode;
+DrawElementsIndirectCommand GLTFPrimitive::command(uint8_t lod, uint32_t instance_count, uint32_t base_instance) const {
+	const GeometryRange& range = lods[lod].range;
+	return DrawElementsIndirectCommand{
+		.count = range.index_count,
+		.instance_count = instance_count,
+		.first_index = range.first_index,
+		.base_vertex = range.base_vertex,
+		.base_instance = base_instance,
+	};
+}
 
-	index_bufv = scene->bufferViews[index_acc->bufferView];
-	pos_bufv = scene->bufferViews[pos_acc->bufferView];
-	normal_bufv = scene->bufferViews[normal_acc->bufferView];
-	texcoord_bufv = scene->bufferViews[texcoord_acc->bufferView];
-	
-	index_bufv->bind();
-
-	pos_bufv->bind();
-	glVertexAttribPointer(
-		0, 
-		tinygltf::GetNumComponentsInType(pos_acc->type), 
-		pos_acc->componentType, 
-		pos_acc->normalized ? GL_TRUE : GL_FALSE,
-		pos_acc->ByteStride(pos_bufv->bufv),
-		(void *)(0 + pos_acc->byteOffset)
-	);
-	// std::cout << "pos" << std::endl;
-	// std::cout << "vertex attrib " << 0 << ": " << std::endl << "vbo: " << pos_bufv->handle << ", size: " << tinygltf::GetNumComponentsInType(pos_acc->type)
-	// 		<< ", component type: " << pos_acc->componentType << std::endl 
-	// 		<< "stride: " << pos_acc->ByteStride(pos_bufv->bufv) << ", offset: " << pos_acc->byteOffset << std::endl;
-	glEnableVertexAttribArray(0);
-
-	normal_bufv->bind();
-	glVertexAttribPointer(
-		2, 
-		tinygltf::GetNumComponentsInType(normal_acc->type), 
-		normal_acc->componentType, 
-		normal_acc->normalized ? GL_TRUE : GL_FALSE,
-		normal_acc->ByteStride(normal_bufv->bufv),
-		(void *)(0 + normal_acc->byteOffset)
-	);
-	glEnableVertexAttribArray(2);
-
-	// std::cout << "normal" << std::endl;
-	// std::cout << "vertex attrib " << 2 << ": " << std::endl << "vbo: " << normal_bufv->handle << ", size: " << tinygltf::GetNumComponentsInType(normal_acc->type)
-	// 		<< ", component type: " << normal_acc->componentType << std::endl 
-	// 		<< "stride: " << normal_acc->ByteStride(normal_bufv->bufv) << ", offset: " << normal_acc->byteOffset << std::endl;
-
-	texcoord_bufv->bind();
-	glVertexAttribPointer(
-		1, 
-		tinygltf::GetNumComponentsInType(texcoord_acc->type), 
-		texcoord_acc->componentType, 
-		texcoord_acc->normalized ? GL_TRUE : GL_FALSE,
-		texcoord_acc->ByteStride(texcoord_bufv->bufv),
-		(void *)(0 + texcoord_acc->byteOffset)
-	);
-	glEnableVertexAttribArray(1);
-
-	// std::cout << "texcoord" << std::endl;
-	// std::cout << "vertex attrib " << 1 << ": " << std::endl << "vbo: " << texcoord_bufv->handle << ", size: " << tinygltf::GetNumComponentsInType(texcoord_acc->type)
-	// 		<< ", component type: " << texcoord_acc->componentType << std::endl 
-	// 		<< "stride: " << texcoord_acc->ByteStride(texcoord_bufv->bufv) << ", offset: " << texcoord_acc->byteOffset << std::endl;
-
-	default_material = scene->materials[primitive.material];
-}
-
-void GLTFPrimitive::draw(const Camera& cam, glm::mat4& transform, std::shared_ptr<Material> material) {
-	if (material == nullptr) {
-		material = default_material;
-	}
-	assert(material != nullptr);
-	material->apply(transform, cam);
-
-	glBindVertexArray(vao);
-	index_bufv->bind();
-
-	glDrawElements(mode, index_acc->count, index_acc->componentType, (void*)index_acc->byteOffset);
+DrawElementsIndirectCommand GLTFPrimitive::meshlet_command(size_t meshlet, uint32_t base_instance) const {
+	return DrawElementsIndirectCommand{
+		.count = meshlets[meshlet].index_count,
+		.instance_count = 1,
+		.first_index = meshlets[meshlet].first_index,
+		.base_vertex = lods[0].range.base_vertex,
+		.base_instance = base_instance,
+	};
 }
 
 //// GLTFMesh
 GLTFMesh::GLTFMesh(tinygltf::Model& model, tinygltf::Mesh& mesh, GLTFScene* scene) {
 	for (tinygltf::Primitive& primitive : mesh.primitives) {
 		auto prim = std::make_shared<GLTFPrimitive>(model, primitive, scene);
+		prim->index = static_cast<uint32_t>(scene->primitives.size());
+		scene->primitives.push_back(prim);
 		primitives.push_back(prim);
 	}
 	std::cout << "create " << mesh.primitives.size() << " primitives" << std::endl;
 }
 
-void GLTFMesh::draw(const Camera& cam, glm::mat4& transform, std::shared_ptr<Material> material) {
-	auto* render_queue = GLTFRenderQueue::getInstance();
-	for (const auto& pr : primitives) {
-		// pr->draw(cam, transform, material);
-		glm::vec4 pos = cam.project() * cam.view() * transform * glm::vec4(.0f, .0f, .0f, 1.0f);
-		float z = pos.z / pos.w;
-		if (material == nullptr) {
-			material = pr->default_material;
-		}
-		render_queue->push(GLTFRenderRequest{
-			.cam = &cam,
-			.transform = transform,
-			.material = material,
-			.primitive = pr,
-			.z = z,
-		});
+//// GLTFDrawList
+void GLTFDrawList::reset(Material* override_material) {
+	this->override_material = override_material;
+	transforms.reset();
+	opaque.reset();
+	blend.reset();
+	tested = 0;
+	visible = 0;
+}
+
+void GLTFDrawList::push(const GLTFScene& scene, uint32_t primitive, const glm::mat4& transform, float z, uint8_t lod) {
+	const GLTFPrimitive& prim = *scene.primitives[primitive];
+	GLTFDrawRecord record{
+		.primitive = primitive,
+		.material = override_material ? GLTFDrawRecord::OVERRIDE_MATERIAL : prim.material_index,
+		.transform = transforms.push(transform),
+		.z = z,
+		.lod = lod,
+	};
+	Material* material = material_of(scene, record);
+
+	switch (material->alpha_mode) {
+	case Material::AM_BLEND:
+		blend.push(record);
+		break;
+	default:
+		record.key = make_sort_key(
+			SKP_OPAQUE,
+			material->program_handle(),
+			material->id,
+			material->texture_handle(),
+			primitive,
+			lod,
+			z
+		);
+		opaque.push(record);
+	}
+}
+
+void GLTFDrawList::append(const GLTFDrawList& other) {
+	uint32_t base = static_cast<uint32_t>(transforms.size());
+	std::copy(other.transforms.begin(), other.transforms.end(), transforms.alloc(other.transforms.size()));
+	auto rebase = [base](FrameArena<GLTFDrawRecord>& to, const FrameArena<GLTFDrawRecord>& from) {
+		GLTFDrawRecord* out = to.alloc(from.size());
+		for (const GLTFDrawRecord& record : from) {
+			*out = record;
+			out->transform += base;
+			++out;
+		}
+	};
+	rebase(opaque, other.opaque);
+	rebase(blend, other.blend);
+	tested += other.tested;
+	visible += other.visible;
+}
+
+Material* GLTFDrawList::material_of(const GLTFScene& scene, const GLTFDrawRecord& record) const {
+	if (record.material == GLTFDrawRecord::OVERRIDE_MATERIAL) {
+		return override_material;
 	}
+	return scene.materials[record.material].get();
 }
 
 GLTFRenderQueue* GLTFRenderQueue::getInstance() {
@@ -337,34 +994,352 @@ GLTFRenderQueue* GLTFRenderQueue::getInstance() {
 	return instance;
 }
 
-void GLTFRenderQueue::push(GLTFRenderRequest&& request) {
-	switch (request.material->alpha_mode) {
-	case Material::AM_BLEND:
-		blend_queue.push_back(request);
-		break;
-	default:
-		opaque_queue.push_back(request);
+const char* GLTFRenderQueue::opaque_order_name(OpaqueOrder order) {
+	switch (order) {
+	case OO_STATE: return "state";
+	case OO_FRONT_TO_BACK: return "front-to-back";
+	case OO_DEPTH_PREPASS: return "depth prepass";
+	default: return "unknown";
 	}
 }
 
-void GLTFRenderQueue::render() {
-	glDepthMask(GL_TRUE);
-	// glDepthFunc(GL_LESS);
-	while (!opaque_queue.empty()) {
-		GLTFRenderRequest& request = opaque_queue.front();
-		request.primitive->draw(*request.cam, request.transform, request.material);
-		opaque_queue.pop_front();
+DynamicBuffer& GLTFRenderQueue::stream_buffer() {
+	if (stream == nullptr) {
+		stream = std::make_unique<DynamicBuffer>();
 	}
-	opaque_queue.clear();
+	return *stream;
+}
 
-	glDepthMask(GL_FALSE);
-	// glDepthFunc(GL_ALWAYS);
-	std::sort(blend_queue.begin(), blend_queue.end());
-	while (!blend_queue.empty()) {
-		GLTFRenderRequest& request = blend_queue.front();
-		request.primitive->draw(*request.cam, request.transform, request.material);
-		blend_queue.pop_front();
+Material* GLTFRenderQueue::material_of(const GLTFDrawRecord& record) const {
+	return list->material_of(*scene, record);
+}
+
+void GLTFRenderQueue::count_switches(const GLTFDrawRecord& record, DrawState& state, RenderStats& stats) const {
+	const Material* material = material_of(record);
+	GLuint program = material->program_handle();
+	GLuint texture = material->texture_handle();
+	GLuint vao = scene->geometry.vao_of(scene->primitives[record.primitive]->lods[0].range.index_type);
+	stats.program_switches += (program != state.program);
+	stats.texture_switches += (texture != state.texture);
+	stats.vao_switches += (vao != state.vao);
+	state = DrawState{ program, texture, vao };
+}
+
+// model matrices in submission order, so runs of draws can be instanced,
+// with the positions' dequantization folded in; returns the instance index
+// of the first one
+uint32_t GLTFRenderQueue::upload_instances() {
+	instance_transforms.reset();
+	bool quantized = scene->geometry.quantize;
+	auto push = [&](const GLTFDrawRecord& record) {
+		const glm::mat4& transform = list->transforms[record.transform];
+		instance_transforms.push(quantized ? transform * scene->primitives[record.primitive]->dequantization : transform);
+	};
+	for (const auto& record : list->opaque) {
+		push(record);
 	}
-	blend_queue.clear();
-	glDepthMask(GL_TRUE);
+	for (const auto& record : list->blend) {
+		push(record);
+	}
+	if (instance_transforms.empty()) {
+		return 0;
+	}
+	static_assert(DynamicBuffer::ALIGNMENT % sizeof(glm::mat4) == 0);
+	size_t offset = stream_buffer().write(instance_transforms.data(), instance_transforms.size() * sizeof(glm::mat4));
+	return static_cast<uint32_t>(offset / sizeof(glm::mat4));
 }
+
+// Consecutive records with the same primitive and material become one
+// instanced command; consecutive commands with the same material and mode
+// become one batch. The instance attribute advances with base_instance, so
+// every command finds its model matrices without gl_DrawID. A single instance
+// of a clustered primitive at full detail becomes one command per meshlet
+// when meshlets are culled.
+void GLTFRenderQueue::build_batches(FrameArena<GLTFDrawRecord>& records, uint32_t base_instance) {
+	size_t first_batch = batches.size();
+	size_t n = records.size();
+	size_t i = 0;
+	while (i < n) {
+		const GLTFDrawRecord& first = records[i];
+		size_t j = i + 1;
+		while (instancing && j < n && records[j].primitive == first.primitive && records[j].material == first.material
+				&& records[j].lod == first.lod) {
+			++j;
+		}
+		const GLTFPrimitive& prim = *scene->primitives[first.primitive];
+		uint32_t instance = base_instance + static_cast<uint32_t>(i);
+		uint32_t command = static_cast<uint32_t>(commands.size());
+		uint32_t command_count = 1;
+		if (expand_meshlets && j - i == 1 && first.lod == 0 && !prim.meshlets.empty()) {
+			command_count = static_cast<uint32_t>(prim.meshlets.size());
+			for (uint32_t m = 0; m < command_count; ++m) {
+				commands.push(prim.meshlet_command(m, instance));
+				command_z.push(first.z);
+				command_primitive.push(first.primitive);
+				command_meshlet.push(prim.first_meshlet + m);
+			}
+		} else {
+			commands.push(prim.command(first.lod, static_cast<uint32_t>(j - i), instance));
+			command_z.push(first.z);
+			command_primitive.push(first.primitive);
+			command_meshlet.push(NO_MESHLET);
+		}
+
+		GLenum index_type = prim.lods[0].range.index_type;
+		bool cull = list->cull_back_faces && !material_of(first)->double_sided;
+		if (batches.size() > first_batch) {
+			DrawBatch& last = batches[batches.size() - 1];
+			if (records[last.record].material == first.material && last.mode == prim.mode && last.index_type == index_type) {
+				last.command_count += command_count;
+				i = j;
+				continue;
+			}
+		}
+		batches.push(DrawBatch{ static_cast<uint32_t>(i), command, command_count, prim.mode, index_type, cull });
+		i = j;
+	}
+}
+
+// Reorders the commands of each batch by depth. Records are sorted by key, so
+// the first record of an instanced run, whose z the command keeps, is its
+// nearest instance.
+void GLTFRenderQueue::sort_front_to_back(size_t first_batch, size_t last_batch) {
+	for (size_t b = first_batch; b < last_batch; ++b) {
+		const DrawBatch& batch = batches[b];
+		if (batch.command_count < 2) {
+			continue;
+		}
+		command_scratch.reset();
+		DepthSortedCommand* sorted = command_scratch.alloc(batch.command_count);
+		for (uint32_t c = 0; c < batch.command_count; ++c) {
+			uint32_t k = batch.first_command + c;
+			sorted[c] = DepthSortedCommand{ command_z[k], command_primitive[k], command_meshlet[k], commands[k] };
+		}
+		std::sort(sorted, sorted + batch.command_count, [](const DepthSortedCommand& a, const DepthSortedCommand& b) {
+			return a.z < b.z;
+		});
+		for (uint32_t c = 0; c < batch.command_count; ++c) {
+			commands[batch.first_command + c] = sorted[c].command;
+			command_z[batch.first_command + c] = sorted[c].z;
+			command_primitive[batch.first_command + c] = sorted[c].primitive;
+			command_meshlet[batch.first_command + c] = sorted[c].meshlet;
+		}
+	}
+}
+
+// Lays down depth for the opaque batches with a single program, so the
+// colour pass shades each pixel once. Batches only differ by material here,
+// consecutive ones with the same mode, index type and face culling share a
+// multi-draw; the culling must match the colour pass or GL_EQUAL fails.
+void GLTFRenderQueue::depth_prepass(size_t last_batch, size_t command_offset) {
+	auto* gl_state = GLState::getInstance();
+	gl_state->bind_buffer(GL_DRAW_INDIRECT_BUFFER, stream_buffer().handle);
+	depth_prepass_material->bind();
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	size_t b = 0;
+	while (b < last_batch) {
+		size_t e = b + 1;
+		uint32_t count = batches[b].command_count;
+		while (e < last_batch && batches[e].mode == batches[b].mode && batches[e].index_type == batches[b].index_type
+				&& batches[e].cull == batches[b].cull) {
+			count += batches[e].command_count;
+			++e;
+		}
+		frame_sorted_stats.submits += 1;
+		gl_state->enable_cull(batches[b].cull);
+		gl_state->bind_vertex_array(scene->geometry.vao_of(batches[b].index_type));
+		glMultiDrawElementsIndirect(batches[b].mode, batches[b].index_type,
+			(void*)(command_offset + batches[b].first_command * sizeof(DrawElementsIndirectCommand)), count, 0);
+		b = e;
+	}
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+// returns the offset of the commands in the stream buffer
+size_t GLTFRenderQueue::upload_commands() {
+	if (commands.empty()) {
+		return 0;
+	}
+	return stream_buffer().write(commands.data(), commands.size() * sizeof(DrawElementsIndirectCommand));
+}
+
+// returns the offset of the bounds in the stream buffer
+size_t GLTFRenderQueue::upload_command_bounds() {
+	command_bounds.reset();
+	glm::vec4* out = command_bounds.alloc(2 * commands.size());
+	for (uint32_t primitive : command_primitive) {
+		const AABB& bounds = scene->primitives[primitive]->vertex_bounds;
+		*out++ = glm::vec4(bounds.min, 1.0f);
+		*out++ = glm::vec4(bounds.max, 1.0f);
+	}
+	return stream_buffer().write(command_bounds.data(), command_bounds.size() * sizeof(glm::vec4));
+}
+
+// the GPU empties the commands of meshlets outside the list's frustum or,
+// when the list culls back faces, facing away from its eye
+void GLTFRenderQueue::cull_meshlets(size_t command_offset) {
+	meshlet_jobs.reset();
+	for (uint32_t c = 0; c < commands.size(); ++c) {
+		if (command_meshlet[c] != NO_MESHLET) {
+			meshlet_jobs.push(glm::uvec2(c, command_meshlet[c]));
+		}
+	}
+	if (meshlet_jobs.empty()) {
+		return;
+	}
+	glm::vec4 view[7];
+	std::copy(std::begin(list->frustum.planes), std::end(list->frustum.planes), view);
+	// w: whether the cones may cull, which needs the back faces culled too
+	view[6] = glm::vec4(list->eye, list->cull_back_faces ? 1.0f : .0f);
+	size_t view_offset = stream_buffer().write(view, sizeof(view));
+	size_t jobs_offset = stream_buffer().write(meshlet_jobs.data(), meshlet_jobs.size() * sizeof(glm::uvec2));
+	scene->meshlet_culler->cull(stream_buffer().handle, command_offset, jobs_offset, view_offset,
+		static_cast<uint32_t>(meshlet_jobs.size()));
+}
+
+void GLTFRenderQueue::submit(FrameArena<GLTFDrawRecord>& records, size_t first_batch, size_t last_batch, size_t command_offset, DrawState& state) {
+	auto* gl_state = GLState::getInstance();
+	gl_state->bind_buffer(GL_DRAW_INDIRECT_BUFFER, stream_buffer().handle);
+	for (size_t b = first_batch; b < last_batch; ++b) {
+		const DrawBatch& batch = batches[b];
+		const GLTFDrawRecord& record = records[batch.record];
+		count_switches(record, state, frame_sorted_stats);
+		frame_sorted_stats.draws += batch.command_count;
+		frame_sorted_stats.submits += 1;
+		for (uint32_t c = 0; c < batch.command_count; ++c) {
+			const DrawElementsIndirectCommand& command = commands[batch.first_command + c];
+			frame_sorted_stats.instances += command.instance_count;
+			if (batch.mode == GL_TRIANGLES) {
+				frame_sorted_stats.triangles += command.count / 3 * command.instance_count;
+			}
+		}
+
+		material_of(record)->bind();
+		gl_state->enable_cull(batch.cull);
+		gl_state->bind_vertex_array(scene->geometry.vao_of(batch.index_type));
+		glMultiDrawElementsIndirect(batch.mode, batch.index_type,
+			(void*)(command_offset + batch.first_command * sizeof(DrawElementsIndirectCommand)), batch.command_count, 0);
+	}
+}
+
+void GLTFRenderQueue::render(GLTFScene* scene, GLTFDrawList& list, HiZCuller* occlusion) {
+	this->scene = scene;
+	this->list = &list;
+	FrameArena<GLTFDrawRecord>& opaque_queue = list.opaque;
+	FrameArena<GLTFDrawRecord>& blend_queue = list.blend;
+
+	DrawState unsorted_state, sorted_state;
+	for (const auto& record : opaque_queue) {
+		count_switches(record, unsorted_state, frame_unsorted_stats);
+	}
+	for (const auto& record : blend_queue) {
+		count_switches(record, unsorted_state, frame_unsorted_stats);
+	}
+	uint32_t pushed = static_cast<uint32_t>(opaque_queue.size() + blend_queue.size());
+	frame_unsorted_stats.draws += pushed;
+	frame_unsorted_stats.instances += pushed;
+	frame_unsorted_stats.submits += pushed;
+
+	if (sort_opaque) {
+		sort_scratch.reset();
+		radix_sort_by_key(opaque_queue.data(), sort_scratch.alloc(opaque_queue.size()), opaque_queue.size());
+	}
+	std::sort(blend_queue.begin(), blend_queue.end(), [](const GLTFDrawRecord& a, const GLTFDrawRecord& b) {
+		return a.z > b.z;
+	});
+
+	// build against a provisional base instance, commands are patched below
+	expand_meshlets = list.meshlet_culling && scene->meshlet_culler != nullptr && scene->meshlet_culler->supported();
+	commands.reset();
+	command_z.reset();
+	command_primitive.reset();
+	command_meshlet.reset();
+	batches.reset();
+	build_batches(opaque_queue, 0);
+	size_t opaque_batches = batches.size();
+	build_batches(blend_queue, static_cast<uint32_t>(opaque_queue.size()));
+	if (opaque_order != OO_STATE) {
+		sort_front_to_back(0, opaque_batches);
+	}
+
+	// instances, commands, their bounds and the meshlet jobs must end up in
+	// the same buffer; jobs are at most one per command
+	bool occlude = occlusion != nullptr && occlusion->ready() && !commands.empty();
+	stream_buffer().reserve((opaque_queue.size() + blend_queue.size()) * sizeof(glm::mat4)
+		+ commands.size() * sizeof(DrawElementsIndirectCommand)
+		+ (occlude ? 2 * commands.size() * sizeof(glm::vec4) : 0)
+		+ (expand_meshlets ? 7 * sizeof(glm::vec4) + commands.size() * sizeof(glm::uvec2) : 0)
+		+ 5 * DynamicBuffer::ALIGNMENT);
+	uint32_t base_instance = upload_instances();
+	for (auto& command : commands) {
+		command.base_instance += base_instance;
+	}
+	size_t command_offset = upload_commands();
+	if (expand_meshlets) {
+		cull_meshlets(command_offset);
+	}
+	if (occlude) {
+		// the GPU drops occluded instances from the commands just uploaded
+		size_t bounds_offset = upload_command_bounds();
+		occlusion->cull(stream_buffer().handle, command_offset, bounds_offset,
+			static_cast<uint32_t>(commands.size()), static_cast<uint32_t>(opaque_queue.size() + blend_queue.size()));
+	}
+
+	// reserve() may have recreated the stream buffer, and the depth pre-pass
+	// draws through the VAO too, so rebind before either pass or the pre-pass
+	// writes depths from stale matrices that the GL_EQUAL pass then rejects
+	DynamicBuffer& stream = stream_buffer();
+	if (scene->geometry.instance_buffer_version != stream.version) {
+		scene->geometry.bind_instance_buffer(stream.handle, stream.version, Material::MODEL_LOCATION);
+	}
+
+	// passes with an override material are depth-only already
+	bool prepass = opaque_order == OO_DEPTH_PREPASS && list.override_material == nullptr
+		&& depth_prepass_material != nullptr && opaque_batches > 0;
+
+	auto* gl_state = GLState::getInstance();
+	gl_state->depth_mask(GL_TRUE);
+	gl_state->depth_func(GL_LESS);
+	if (prepass) {
+		depth_prepass(opaque_batches, command_offset);
+		gl_state->depth_mask(GL_FALSE);
+		gl_state->depth_func(GL_EQUAL);
+	}
+	submit(opaque_queue, 0, opaque_batches, command_offset, sorted_state);
+	gl_state->depth_func(GL_LESS);
+
+	gl_state->depth_mask(GL_FALSE);
+	submit(blend_queue, opaque_batches, batches.size(), command_offset, sorted_state);
+	gl_state->depth_mask(GL_TRUE);
+	gl_state->enable_cull(false);
+	// the same geometry in either order
+	frame_unsorted_stats.triangles = frame_sorted_stats.triangles;
+}
+
+void GLTFRenderQueue::end_frame() {
+	if (stream != nullptr) {
+		stream->end_frame();
+	}
+	unsorted_stats = frame_unsorted_stats;
+	sorted_stats = frame_sorted_stats;
+	frame_unsorted_stats = RenderStats{};
+	frame_sorted_stats = RenderStats{};
+}
+
+void GLTFRenderQueue::print_stats(std::ostream& os) const {
+	auto print = [&os](const char* name, const RenderStats& stats) {
+		os << name << ": draws " << stats.draws
+			<< ", instances " << stats.instances
+			<< ", triangles " << stats.triangles
+			<< ", gl draw calls " << stats.submits
+			<< ", program switches " << stats.program_switches
+			<< ", texture switches " << stats.texture_switches
+			<< ", vao switches " << stats.vao_switches << std::endl;
+	};
+	os << "opaque order: " << opaque_order_name(opaque_order) << std::endl;
+	print("push order", unsorted_stats);
+	print("submitted", sorted_stats);
+	if (stream != nullptr) {
+		stream->print_stats(os);
+	}
+}
\ No newline at end of file
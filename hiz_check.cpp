@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <glad/glad.h>
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+#include "gltf_scene.hpp"
+#include "framebuffer.hpp"
+#include "light.hpp"
+#include "hiz_culler.hpp"
+#include "uniform_blocks.hpp"
+
+// Checks Hi-Z occlusion culling without a window. On a surfaceless EGL
+// context (llvmpipe when there is no GPU) it draws the main pass of a scene
+// from several views into a 4x multisampled framebuffer, like QuickOpenGL's
+// default one, once with the culler off and once on. It passes if:
+// - culling left the images unchanged and no more objects visible
+// - some view had objects culled
+// - every texel of the culler's copy of the multisampled depth is within
+//   the depths of the samples it was copied from
+// Without EGL it returns 77, which ctest counts as skipped.
+namespace {
+
+constexpr int SKIPPED = 77;
+constexpr GLuint WIDTH = 1080, HEIGHT = 720;
+constexpr GLsizei SAMPLES = 4;
+
+// Colour in a renderbuffer; depth in a texture, so the samples can be read
+struct RenderTarget {
+	GLuint fbo = 0, color = 0, depth = 0;
+
+	RenderTarget(GLsizei samples) {
+		glGenRenderbuffers(1, &color);
+		glBindRenderbuffer(GL_RENDERBUFFER, color);
+		glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, WIDTH, HEIGHT);
+		glGenTextures(1, &depth);
+		GLenum target = samples > 0 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+		GLState::getInstance()->bind_texture(target, depth);
+		if (samples > 0) {
+			glTexStorage2DMultisample(target, samples, GL_DEPTH24_STENCIL8, WIDTH, HEIGHT, GL_TRUE);
+		} else {
+			glTexStorage2D(target, 1, GL_DEPTH24_STENCIL8, WIDTH, HEIGHT);
+		}
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, target, depth, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			throw std::runtime_error("incomplete offscreen framebuffer");
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+	~RenderTarget() {
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteRenderbuffers(1, &color);
+		glDeleteTextures(1, &depth);
+		GLState::getInstance()->invalidate();
+	}
+	RenderTarget(const RenderTarget&) = delete;
+	RenderTarget& operator=(const RenderTarget&) = delete;
+};
+
+// nearest and farthest sample depth of every pixel of a multisampled texture
+const char* sample_range_shader = R"(
+	#version 430 core
+	layout (local_size_x = 8, local_size_y = 8) in;
+	layout (binding = 0) uniform sampler2DMS depth;
+	layout (binding = 0, rg32f) uniform writeonly image2D range;
+	uniform int samples;
+
+	void main() {
+		ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+		if (any(greaterThanEqual(p, imageSize(range)))) {
+			return;
+		}
+		vec2 r = vec2(1.0, 0.0);
+		for (int s = 0; s < samples; ++s) {
+			float d = texelFetch(depth, p, s).r;
+			r = vec2(min(r.x, d), max(r.y, d));
+		}
+		imageStore(range, p, vec4(r, 0.0, 0.0));
+	}
+)";
+
+bool create_context() {
+	auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+	EGLDisplay display = get_platform_display != nullptr
+		? get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr)
+		: eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	EGLint major, minor;
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor) || !eglBindAPI(EGL_OPENGL_API)) {
+		return false;
+	}
+	const EGLint attributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE,
+	};
+	// no config and no surface: everything is drawn into framebuffer objects
+	EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		return false;
+	}
+	return gladLoadGLLoader(reinterpret_cast<GLADloadproc>(eglGetProcAddress)) != 0;
+}
+
+// the colour of target, resolved
+std::vector<uint32_t> read_color(const RenderTarget& target) {
+	RenderTarget resolved(0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, target.fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolved.fbo);
+	glBlitFramebuffer(0, 0, WIDTH, HEIGHT, 0, 0, WIDTH, HEIGHT, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	std::vector<uint32_t> pixels(WIDTH * HEIGHT);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, resolved.fbo);
+	glReadPixels(0, 0, WIDTH, HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return pixels;
+}
+
+// the nearest and farthest sample depth of every pixel of target
+std::vector<glm::vec2> read_sample_range(const RenderTarget& target, ShaderProgram& program) {
+	auto* gl_state = GLState::getInstance();
+	GLuint range;
+	glGenTextures(1, &range);
+	gl_state->bind_texture(GL_TEXTURE_2D, range);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32F, WIDTH, HEIGHT);
+	program.use();
+	program.set(program.uniform<int>("samples"), static_cast<int>(SAMPLES));
+	gl_state->bind_texture(GL_TEXTURE0, GL_TEXTURE_2D_MULTISAMPLE, target.depth);
+	glBindImageTexture(0, range, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG32F);
+	glDispatchCompute((WIDTH + 7) / 8, (HEIGHT + 7) / 8, 1);
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+	std::vector<glm::vec2> ranges(WIDTH * HEIGHT);
+	gl_state->bind_texture(GL_TEXTURE_2D, range);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_FLOAT, ranges.data());
+	glDeleteTextures(1, &range);
+	gl_state->invalidate();
+	return ranges;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	std::string filename = argc > 1 ? argv[1] : "resource/forest_house/scene.gltf";
+	if (!create_context()) {
+		std::cerr << "hi-z check: no EGL context, skipped" << std::endl;
+		return SKIPPED;
+	}
+	std::cout << "hi-z check: " << glGetString(GL_RENDERER) << ", GL " << glGetString(GL_VERSION) << std::endl;
+
+	glm::vec3 light_position(.0f, 5.0f, 3.0f);
+	auto light = std::make_shared<PointLight>(PointLight{
+		.position = light_position,
+		.color = glm::vec3(1.0f),
+		.intensity = 30.0f,
+		.light_cam = Camera{
+			.fovy = glm::radians(20.0f),
+			.aspect = 1.0f,
+			.pos = light_position,
+			.up = glm::vec3(.0f, 1.0f, .0f),
+			.look_at = glm::vec3(.0f),
+		},
+	});
+
+	Shader vert("shader.vert", GL_VERTEX_SHADER);
+	Shader frag("shader.frag", GL_FRAGMENT_SHADER);
+	auto shader = std::make_shared<ShaderProgram>(vert, frag);
+	Shader range_shader(sample_range_shader, GL_COMPUTE_SHADER, 0);
+	ShaderProgram range_program(range_shader);
+	// no shadow pass: a cleared shadow map lights everything
+	Framebuffer depth_frame_buf;
+	auto shadow_map = std::make_shared<Texture>(depth_frame_buf.handle, 16, 16);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	depth_frame_buf.unbind();
+
+	GLTFScene scene(filename);
+	if (scene.model.meshes.empty()) {
+		std::cerr << "hi-z check: failed to load " << filename << std::endl;
+		return 1;
+	}
+	scene.init(shader, light, shadow_map);
+	scene.update_matrix(glm::scale(glm::mat4(1.0f), glm::vec3(10.0f, 10.0f, 10.0f)));
+
+	HiZCuller hiz;
+	if (!hiz.supported()) {
+		std::cerr << "hi-z check: culler unsupported" << std::endl;
+		return 1;
+	}
+	GLTFView view;
+	view.name = "main";
+	view.occlusion = &hiz;
+	PassUniformBuffer pass_uniforms;
+	glEnable(GL_DEPTH_TEST);
+	RenderTarget target(SAMPLES);
+
+	auto draw = [&](const Camera& camera) {
+		scene.update();
+		view.cam = camera;
+		view.viewport_height = static_cast<float>(HEIGHT);
+		scene.build(&view, 1);
+		glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+		glViewport(0, 0, WIDTH, HEIGHT);
+		glClearColor(.0f, .0f, .0f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		pass_uniforms.update(camera, *light);
+		scene.render(view);
+		hiz.capture(camera.project() * camera.view(), WIDTH, HEIGHT, target.fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		GLTFRenderQueue::getInstance()->end_frame();
+	};
+
+	bool passed = true;
+	auto expect = [&](bool condition, const std::string& what) {
+		if (!condition) {
+			std::cerr << "hi-z check failed: " << what << std::endl;
+			passed = false;
+		}
+	};
+
+	// QuickOpenGL's camera, then around the scene at eye height
+	std::vector<glm::vec3> eyes = { glm::vec3(-1.5f, 0.2f, -1.0f) };
+	for (float radius : { 2.0f, 4.0f }) {
+		for (int i = 0; i < 6; ++i) {
+			float angle = glm::radians(60.0f * i + 15.0f);
+			eyes.push_back(glm::vec3(radius * std::cos(angle), 0.2f, radius * std::sin(angle)));
+		}
+	}
+	uint64_t total_occluded = 0;
+	for (const glm::vec3& eye : eyes) {
+		Camera camera{
+			.fovy = glm::radians(45.0f),
+			.aspect = (float)WIDTH / HEIGHT,
+			.pos = eye,
+			.up = glm::vec3(.0f, 1.0f, .0f),
+		};
+		hiz.enabled = false;
+		draw(camera);
+		std::vector<uint32_t> image_off = read_color(target);
+		uint32_t visible_off = view.list.visible;
+
+		// the first frame captures the pyramid the second one culls against
+		hiz.enabled = true;
+		draw(camera);
+		uint32_t culled_before = hiz.culled();
+		uint64_t tested_before = hiz.tested;
+		draw(camera);
+		uint32_t occluded = hiz.culled() - culled_before;
+		uint64_t tested = hiz.tested - tested_before;
+		uint32_t visible_on = view.list.visible - occluded;
+		std::vector<uint32_t> image_on = read_color(target);
+		total_occluded += occluded;
+
+		size_t different_pixels = 0;
+		for (size_t i = 0; i < image_off.size(); ++i) {
+			different_pixels += image_off[i] != image_on[i];
+		}
+
+		// the culler's depth copy of the second frame, against its samples
+		std::vector<float> copied(WIDTH * HEIGHT, -1.0f);
+		if (hiz.ready()) {
+			GLState::getInstance()->bind_texture(GL_TEXTURE_2D, hiz.depth_copy());
+			glGetTexImage(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, GL_FLOAT, copied.data());
+		}
+		std::vector<glm::vec2> ranges = read_sample_range(target, range_program);
+		size_t covered = 0, outside = 0;
+		for (size_t i = 0; i < copied.size(); ++i) {
+			covered += ranges[i].x < 1.0f;
+			outside += copied[i] < ranges[i].x - 1e-6f || copied[i] > ranges[i].y + 1e-6f;
+		}
+
+		std::string name = "view at (" + std::to_string(eye.x) + ", " + std::to_string(eye.z) + ")";
+		std::cout << "hi-z check: " << name << ": off " << visible_off << " visible; on " << visible_on << " visible, "
+			<< occluded << " of " << tested << " occluded; " << different_pixels << " pixels differ; depth copy "
+			<< outside << " of " << copied.size() << " texels outside their samples, " << covered << " covered" << std::endl;
+		expect(hiz.ready(), name + ": the culler disabled itself, the depth copy failed");
+		expect(tested == visible_off, name + ": the culler did not test every visible instance");
+		expect(visible_on <= visible_off, name + ": more objects visible with occlusion culling");
+		expect(different_pixels == 0, name + ": occlusion culling changed the image");
+		expect(outside == 0, name + ": the depth copy does not match the multisampled depth");
+	}
+	expect(total_occluded > 0, "no view had anything occluded");
+	std::cout << "hi-z check: " << total_occluded << " instances occluded over " << eyes.size() << " views, "
+		<< (passed ? "passed" : "FAILED") << std::endl;
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,277 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "gl_state.hpp"
+#include "shader.hpp"
+
+// shader storage bindings of hiz_cull.comp
+enum HiZStorageBinding {
+	HSB_INSTANCES = 0,
+	HSB_COMMANDS = 1,
+	HSB_BOUNDS = 2,
+	HSB_STATS = 3,
+};
+
+// GPU occlusion culling against a hierarchical depth (Hi-Z) pyramid. After a
+// pass is drawn, capture() copies its depth and reduces it with
+// hiz_reduce.comp into a mip chain of the farthest depth per texel. The next
+// frame cull() runs hiz_cull.comp over the indirect commands of a pass, which
+// drops every instance whose bounds lie behind the pyramid. Without compute
+// shaders, or before the first capture, ready() is false and the draws are
+// frustum culled only.
+struct HiZCuller {
+	// local_size_x of hiz_cull.comp
+	static constexpr uint32_t GROUP_SIZE = 64;
+
+	HiZCuller();
+	~HiZCuller();
+	HiZCuller(const HiZCuller&) = delete;
+	HiZCuller& operator=(const HiZCuller&) = delete;
+
+	bool supported() const {
+		return reduce_program != nullptr && cull_program != nullptr;
+	}
+
+	bool ready() const {
+		return enabled && supported() && captured;
+	}
+
+	// builds the pyramid from the depth of source, the default framebuffer
+	// unless given, which was drawn with vp; source may be multisampled
+	void capture(const glm::mat4& vp, GLuint width, GLuint height, GLuint source = 0);
+	// Culls command_count DrawElementsIndirectCommands at command_offset in
+	// buffer, whose instances' model matrices are in the same buffer. The
+	// local bounds of each command's primitive are at bounds_offset, as a
+	// min and a max vec4. Both offsets must be multiples of 16.
+	void cull(GLuint buffer, size_t command_offset, size_t bounds_offset, uint32_t command_count, uint32_t instance_count);
+	// reads the culled counter back, so it stalls; call outside the frame
+	void print_stats(std::ostream& os);
+	// instances culled since creation; stalls like print_stats()
+	uint32_t culled();
+	// the single sampled depth copy of the last capture(), 0 before the first
+	GLuint depth_copy() const {
+		return captured ? depth_texture : 0;
+	}
+
+	bool enabled = true;
+	// instances tested by cull()
+	uint64_t tested = 0;
+private:
+	void create_targets(GLuint width, GLuint height, GLuint source);
+	void destroy_targets();
+	GLenum depth_format_of(GLuint source) const;
+
+	std::unique_ptr<ShaderProgram> reduce_program, cull_program;
+	struct ReduceUniforms {
+		Uniform<int> src_level;
+	} reduce_uniforms;
+	struct CullUniforms {
+		Uniform<glm::mat4> vp;
+		Uniform<int> command_base, bounds_base, command_count, levels;
+	} cull_uniforms;
+
+	GLuint stats_buffer = 0;
+	// single sampled copy of the source framebuffer's depth
+	GLuint depth_fbo = 0, depth_texture = 0;
+	GLuint pyramid = 0;
+	GLuint width = 0, height = 0;
+	int level_count = 0;
+	glm::mat4 pyramid_vp = glm::mat4(1.0f);
+	bool captured = false;
+};
+
+HiZCuller::HiZCuller() {
+	if (GLVersion.major < 4 || (GLVersion.major == 4 && GLVersion.minor < 3)) {
+		std::cout << "hi-z culling: needs GL 4.3 compute shaders, frustum culling only" << std::endl;
+		return;
+	}
+	try {
+		Shader reduce("hiz_reduce.comp", GL_COMPUTE_SHADER);
+		Shader cull("hiz_cull.comp", GL_COMPUTE_SHADER);
+		if (reduce.success != GL_TRUE || cull.success != GL_TRUE) {
+			throw std::runtime_error("failed to compile hi-z shaders");
+		}
+		auto reduce_linked = std::make_unique<ShaderProgram>(reduce);
+		auto cull_linked = std::make_unique<ShaderProgram>(cull);
+		if (!reduce_linked->success || !cull_linked->success) {
+			throw std::runtime_error("failed to link hi-z shaders");
+		}
+		reduce_program = std::move(reduce_linked);
+		cull_program = std::move(cull_linked);
+	} catch (const std::runtime_error& e) {
+		std::cerr << "hi-z culling: " << e.what() << ", frustum culling only" << std::endl;
+		return;
+	}
+	reduce_uniforms.src_level = reduce_program->uniform<int>("src_level");
+	cull_uniforms.vp = cull_program->uniform<glm::mat4>("vp");
+	cull_uniforms.command_base = cull_program->uniform<int>("command_base");
+	cull_uniforms.bounds_base = cull_program->uniform<int>("bounds_base");
+	cull_uniforms.command_count = cull_program->uniform<int>("command_count");
+	cull_uniforms.levels = cull_program->uniform<int>("levels");
+
+	uint32_t zero = 0;
+	glGenBuffers(1, &stats_buffer);
+	GLState::getInstance()->bind_buffer(GL_SHADER_STORAGE_BUFFER, stats_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(zero), &zero, GL_DYNAMIC_COPY);
+}
+
+HiZCuller::~HiZCuller() {
+	destroy_targets();
+	if (stats_buffer != 0) {
+		glDeleteBuffers(1, &stats_buffer);
+		GLState::getInstance()->invalidate();
+	}
+}
+
+// Blitting depth needs matching formats, so the copy takes the one of the
+// framebuffer it copies from
+GLenum HiZCuller::depth_format_of(GLuint source) const {
+	GLint depth_bits = 0, stencil_bits = 0;
+	glBindFramebuffer(GL_FRAMEBUFFER, source);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, source == 0 ? GL_DEPTH : GL_DEPTH_ATTACHMENT,
+		GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depth_bits);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, source == 0 ? GL_STENCIL : GL_DEPTH_ATTACHMENT,
+		GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencil_bits);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (depth_bits == 32) {
+		return stencil_bits > 0 ? GL_DEPTH32F_STENCIL8 : GL_DEPTH_COMPONENT32F;
+	}
+	if (depth_bits == 16) {
+		return GL_DEPTH_COMPONENT16;
+	}
+	return stencil_bits > 0 ? GL_DEPTH24_STENCIL8 : GL_DEPTH_COMPONENT24;
+}
+
+void HiZCuller::create_targets(GLuint width, GLuint height, GLuint source) {
+	destroy_targets();
+	this->width = width;
+	this->height = height;
+	auto* gl_state = GLState::getInstance();
+
+	GLenum depth_format = depth_format_of(source);
+	glGenTextures(1, &depth_texture);
+	gl_state->bind_texture(GL_TEXTURE_2D, depth_texture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, depth_format, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glGenFramebuffers(1, &depth_fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, depth_fbo);
+	bool stencil = depth_format == GL_DEPTH24_STENCIL8 || depth_format == GL_DEPTH32F_STENCIL8;
+	GLenum attachment = stencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+	glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, depth_texture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// level 0 is half the depth resolution, down to 1x1
+	GLuint base_width = std::max(1u, width / 2), base_height = std::max(1u, height / 2);
+	level_count = 1;
+	while ((std::max(base_width, base_height) >> level_count) > 0) {
+		level_count += 1;
+	}
+	glGenTextures(1, &pyramid);
+	gl_state->bind_texture(GL_TEXTURE_2D, pyramid);
+	glTexStorage2D(GL_TEXTURE_2D, level_count, GL_R32F, base_width, base_height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	std::cout << "hi-z pyramid: " << base_width << "x" << base_height << ", " << level_count << " levels" << std::endl;
+}
+
+void HiZCuller::destroy_targets() {
+	if (depth_fbo != 0) {
+		glDeleteFramebuffers(1, &depth_fbo);
+		glDeleteTextures(1, &depth_texture);
+		glDeleteTextures(1, &pyramid);
+		depth_fbo = depth_texture = pyramid = 0;
+		GLState::getInstance()->invalidate();
+	}
+	captured = false;
+}
+
+void HiZCuller::capture(const glm::mat4& vp, GLuint width, GLuint height, GLuint source) {
+	if (!enabled || !supported() || width == 0 || height == 0) {
+		captured = false;
+		return;
+	}
+	bool created = width != this->width || height != this->height || depth_fbo == 0;
+	if (created) {
+		create_targets(width, height, source);
+		while (glGetError() != GL_NO_ERROR) {
+		}
+	}
+	auto* gl_state = GLState::getInstance();
+
+	// resolves a multisampled source, one sample per pixel with GL_NEAREST
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, source);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depth_fbo);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	// a depth format the blit does not accept shows up on the first copy
+	if (GLenum error = created ? glGetError() : GL_NO_ERROR; error != GL_NO_ERROR) {
+		std::cerr << "hi-z culling: depth copy failed with " << error << ", frustum culling only" << std::endl;
+		enabled = false;
+		destroy_targets();
+		return;
+	}
+
+	reduce_program->use();
+	for (int level = 0; level < level_count; ++level) {
+		GLuint dst_width = std::max(1u, (width / 2) >> level), dst_height = std::max(1u, (height / 2) >> level);
+		gl_state->bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, level == 0 ? depth_texture : pyramid);
+		reduce_program->set(reduce_uniforms.src_level, level == 0 ? 0 : level - 1);
+		glBindImageTexture(0, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((dst_width + 7) / 8, (dst_height + 7) / 8, 1);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+	pyramid_vp = vp;
+	captured = true;
+}
+
+void HiZCuller::cull(GLuint buffer, size_t command_offset, size_t bounds_offset, uint32_t command_count, uint32_t instance_count) {
+	if (!ready() || command_count == 0) {
+		return;
+	}
+	auto* gl_state = GLState::getInstance();
+	cull_program->use();
+	cull_program->set(cull_uniforms.vp, pyramid_vp);
+	cull_program->set(cull_uniforms.command_base, static_cast<int>(command_offset / sizeof(uint32_t)));
+	cull_program->set(cull_uniforms.bounds_base, static_cast<int>(bounds_offset / sizeof(glm::vec4)));
+	cull_program->set(cull_uniforms.command_count, static_cast<int>(command_count));
+	cull_program->set(cull_uniforms.levels, level_count);
+	// the instance, command and bounds blocks all alias the stream buffer
+	gl_state->bind_buffer_base(GL_SHADER_STORAGE_BUFFER, HSB_INSTANCES, buffer);
+	gl_state->bind_buffer_base(GL_SHADER_STORAGE_BUFFER, HSB_COMMANDS, buffer);
+	gl_state->bind_buffer_base(GL_SHADER_STORAGE_BUFFER, HSB_BOUNDS, buffer);
+	gl_state->bind_buffer_base(GL_SHADER_STORAGE_BUFFER, HSB_STATS, stats_buffer);
+	gl_state->bind_texture(GL_TEXTURE0, GL_TEXTURE_2D, pyramid);
+	glDispatchCompute((command_count + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+	// the commands are read by the indirect draws, the matrices as instance attributes
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+	tested += instance_count;
+}
+
+void HiZCuller::print_stats(std::ostream& os) {
+	if (!supported()) {
+		os << "hi-z culling: unsupported" << std::endl;
+		return;
+	}
+	os << "hi-z culling: " << (ready() ? "on" : "off") << ", " << culled() << " of " << tested
+		<< " instances occluded" << std::endl;
+}
+
+uint32_t HiZCuller::culled() {
+	uint32_t count = 0;
+	if (stats_buffer == 0) {
+		return count;
+	}
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	GLState::getInstance()->bind_buffer(GL_SHADER_STORAGE_BUFFER, stats_buffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(count), &count);
+	return count;
+}
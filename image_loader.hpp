@@ -0,0 +1,175 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils.hpp"
+#include "benchmark.hpp"
+#include "thread_pool.hpp"
+#include "mapped_file.hpp"
+
+// Takes image decoding off tinygltf's serial load. Attached with
+// SetImageLoader, it only keeps the encoded bytes of every image; decode()
+// then runs tinygltf's stb_image decoder on the ThreadPool. Decoding threads
+// set stb_image's flip flag for themselves, so they never see the flag
+// other loads set. Images in a buffer view are read where they are, so the
+// model's buffers must outlive decode(). Image files are kept through the
+// mapping mapped_fs_callbacks() read them from; tinygltf's own copy of
+// them is freed as soon as store() returns.
+struct DeferredImageLoader {
+	struct Encoded {
+		int image;
+		int req_width, req_height;
+		// into bytes, file or a buffer of the model
+		const unsigned char* data;
+		size_t size;
+		std::vector<unsigned char> bytes;
+		std::shared_ptr<MappedFile> file;
+
+		void release() {
+			bytes = {};
+			file = nullptr;
+		}
+	};
+
+	void attach(tinygltf::TinyGLTF& loader) {
+		loader.SetImageLoader(&DeferredImageLoader::store, this);
+	}
+
+	// Decodes every stored image into model.images on at most max_threads
+	// threads, 0 for the whole pool. Failures are appended to err.
+	bool decode(tinygltf::Model& model, std::string& err, size_t max_threads = 0);
+	// decodes pending[i] alone, on the calling thread
+	bool decode(tinygltf::Model& model, size_t i, std::string& err);
+
+	std::vector<Encoded> pending;
+	// of the glTF file, for image URIs
+	std::string base_dir;
+	// set by the file callbacks of load_gltf_file()
+	LastReadFile last_read;
+private:
+	static bool store(tinygltf::Image* image, const int image_idx, std::string* err, std::string* warn,
+		int req_width, int req_height, const unsigned char* bytes, int size, void* user_data);
+};
+
+bool DeferredImageLoader::store(tinygltf::Image* image, const int image_idx, std::string* /*err*/, std::string* /*warn*/,
+	int req_width, int req_height, const unsigned char* bytes, int size, void* user_data) {
+	auto* self = static_cast<DeferredImageLoader*>(user_data);
+	Encoded encoded{ image_idx, req_width, req_height, bytes, static_cast<size_t>(size), {}, nullptr };
+	std::string path;
+	if (image->bufferView >= 0) {
+		// bytes point into model.buffers, which stay until decoded
+	} else if (!image->uri.empty() && !tinygltf::IsDataURI(image->uri) && tinygltf::URIDecode(image->uri, &path, nullptr)) {
+		// tinygltf's copy of the file is gone after this call, the mapping it
+		// was read from is not
+		LastReadFile& last = self->last_read;
+		if (last.file != nullptr && last.path == tinygltf::JoinPath(self->base_dir, path) && last.file->size() == encoded.size) {
+			encoded.data = last.file->data();
+			encoded.file = std::move(last.file);
+		}
+	}
+	if (encoded.file == nullptr && image->bufferView < 0) {
+		encoded.bytes.assign(bytes, bytes + size);
+		encoded.data = encoded.bytes.data();
+	}
+	self->pending.push_back(std::move(encoded));
+	return true;
+}
+
+bool DeferredImageLoader::decode(tinygltf::Model& model, std::string& err, size_t max_threads) {
+	auto* pool = ThreadPool::getInstance();
+	size_t threads = max_threads == 0 ? pool->concurrency() : std::min(max_threads, pool->concurrency());
+	threads = std::min(threads, pending.size());
+	std::vector<std::string> errors(pending.size());
+	std::atomic<size_t> next{ 0 };
+	// one task per thread pulling images, so max_threads bounds the decodes in flight
+	pool->parallel_for(threads, [&](size_t) {
+		for (size_t i = next.fetch_add(1); i < pending.size(); i = next.fetch_add(1)) {
+			decode(model, i, errors[i]);
+		}
+	});
+	bool ok = true;
+	for (const std::string& error : errors) {
+		if (!error.empty()) {
+			err += error;
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+bool DeferredImageLoader::decode(tinygltf::Model& model, size_t i, std::string& err) {
+	stbi_set_flip_vertically_on_load_thread(false);
+	Encoded& encoded = pending[i];
+	std::string warn;
+	return tinygltf::LoadImageData(&model.images[encoded.image], encoded.image, &err, &warn,
+		encoded.req_width, encoded.req_height, encoded.data, static_cast<int>(encoded.size), nullptr);
+}
+
+// glTF or glb by extension; images stay encoded in images. Files are read
+// through MappedFile, and a glb is parsed from its mapping, so it never has
+// a copy on the heap besides the buffers tinygltf keeps.
+inline bool load_gltf_file(tinygltf::TinyGLTF& loader, DeferredImageLoader& images, tinygltf::Model& model,
+	std::string& err, std::string& warn, const std::string& filename) {
+	images.attach(loader);
+	images.base_dir = tinygltf::GetBaseDir(filename);
+	loader.SetFsCallbacks(mapped_fs_callbacks(&images.last_read));
+	bool result = false;
+	if (filename.ends_with(".gltf")) {
+		result = loader.LoadASCIIFromFile(&model, &err, &warn, filename);
+	} else if (filename.ends_with(".glb")) {
+		MappedFile file(filename);
+		if (!file.is_open()) {
+			err += "failed to open " + filename + "\n";
+			return false;
+		}
+		result = loader.LoadBinaryFromMemory(&model, &err, &warn, file.data(), static_cast<unsigned int>(file.size()), images.base_dir);
+	}
+	// a buffer may have been read last, its mapping is not needed
+	images.last_read = {};
+	return result;
+}
+
+// Times parsing and image decoding of each file at 1, 2, 4 and all of the
+// pool's threads
+inline void benchmark_image_decoding(const std::vector<std::string>& filenames, std::ostream& os) {
+	using clock = std::chrono::high_resolution_clock;
+	size_t all = ThreadPool::getInstance()->concurrency();
+	std::vector<size_t> thread_counts;
+	for (size_t threads : { size_t(1), size_t(2), size_t(4), all }) {
+		if (threads <= all && std::find(thread_counts.begin(), thread_counts.end(), threads) == thread_counts.end()) {
+			thread_counts.push_back(threads);
+		}
+	}
+	for (const std::string& filename : filenames) {
+		tinygltf::TinyGLTF loader;
+		DeferredImageLoader images;
+		tinygltf::Model model;
+		std::string err, warn;
+		auto start = clock::now();
+		if (!load_gltf_file(loader, images, model, err, warn, filename)) {
+			os << filename << ": failed to load" << std::endl;
+			continue;
+		}
+		double parse_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+		size_t encoded = 0;
+		for (const auto& image : images.pending) {
+			encoded += image.size;
+		}
+		os << filename << ": " << images.pending.size() << " images, " << encoded / 1024 << " KiB encoded, parse "
+			<< parse_ms << " ms, decode";
+		const char* separator = " ";
+		for (size_t threads : thread_counts) {
+			double ms = average_ms(3, [&] {
+				images.decode(model, err, threads);
+			});
+			os << separator << ms << " ms on " << threads << (threads == 1 ? " thread" : " threads");
+			separator = ", ";
+		}
+		os << std::endl;
+	}
+}
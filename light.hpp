@@ -9,4 +9,5 @@ struct PointLight {
 	float intensity;
 
 	Camera light_cam;
+	float size = 1.0f;
 };
\ No newline at end of file
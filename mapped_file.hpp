@@ -0,0 +1,137 @@
+#pragma once
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define QUICKGL_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "utils.hpp"
+
+// Read-only view of a whole file. Where mmap exists the pages come straight
+// from the page cache, read ahead sequentially, and never sit on the heap;
+// elsewhere the file is read into memory it owns.
+class MappedFile {
+public:
+	MappedFile() = default;
+	explicit MappedFile(const std::string& filename) {
+		open(filename);
+	}
+	~MappedFile() {
+		close();
+	}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const std::string& filename);
+	void close();
+
+	const unsigned char* data() const {
+		return bytes;
+	}
+	size_t size() const {
+		return length;
+	}
+	bool is_open() const {
+		return bytes != nullptr;
+	}
+
+private:
+	const unsigned char* bytes = nullptr;
+	size_t length = 0;
+	bool mapped = false;
+	std::vector<unsigned char> fallback;
+};
+
+bool MappedFile::open(const std::string& filename) {
+	close();
+#ifdef QUICKGL_MMAP
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void* address = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (address != MAP_FAILED) {
+			// read once front to back, so read ahead aggressively
+			madvise(address, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+			madvise(address, static_cast<size_t>(st.st_size), MADV_WILLNEED);
+			bytes = static_cast<const unsigned char*>(address);
+			length = static_cast<size_t>(st.st_size);
+			mapped = true;
+		}
+	}
+	::close(fd);
+	if (mapped) {
+		return true;
+	}
+#endif
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	if (!file) {
+		return false;
+	}
+	fallback.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	if (fallback.empty() || !file.read(reinterpret_cast<char*>(fallback.data()), fallback.size())) {
+		fallback = {};
+		return false;
+	}
+	bytes = fallback.data();
+	length = fallback.size();
+	return true;
+}
+
+void MappedFile::close() {
+#ifdef QUICKGL_MMAP
+	if (mapped) {
+		munmap(const_cast<unsigned char*>(bytes), length);
+	}
+#endif
+	fallback = {};
+	bytes = nullptr;
+	length = 0;
+	mapped = false;
+}
+
+// the file mapped_fs_callbacks() read last, and its path
+struct LastReadFile {
+	std::string path;
+	std::shared_ptr<MappedFile> file;
+};
+
+// tinygltf's default file callbacks, except that files are read through a
+// MappedFile: they are copied once from the page cache into the vector
+// tinygltf keeps, without going through a stream buffer. If last_read is
+// given, the mapping of the last file read is left there.
+inline tinygltf::FsCallbacks mapped_fs_callbacks(LastReadFile* last_read = nullptr) {
+	tinygltf::FsCallbacks callbacks{
+		&tinygltf::FileExists,
+		&tinygltf::ExpandFilePath,
+		[](std::vector<unsigned char>* out, std::string* err, const std::string& filepath, void* user_data) {
+			auto file = std::make_shared<MappedFile>(filepath);
+			if (!file->is_open()) {
+				if (err) {
+					(*err) += "File open error : " + filepath + "\n";
+				}
+				return false;
+			}
+			out->assign(file->data(), file->data() + file->size());
+			if (user_data != nullptr) {
+				*static_cast<LastReadFile*>(user_data) = { filepath, std::move(file) };
+			}
+			return true;
+		},
+		&tinygltf::WriteWholeFile,
+		&tinygltf::GetFileSizeInBytes,
+		last_read,
+	};
+	return callbacks;
+}
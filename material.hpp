@@ -6,6 +6,7 @@
 #include "shader.hpp"
 #include "camera.hpp"
 #include "light.hpp"
+#include "uniform_blocks.hpp"
 
 struct Material {
 	enum AlphaMode {
@@ -13,29 +14,48 @@ struct Material {
 		AM_MASK = 1,
 		AM_BLEND = 2,
 	};
-	Material(AlphaMode alpha_mode = AM_OPAQUE) : alpha_mode(alpha_mode) { }
-	virtual void apply(glm::mat4 model, const Camera& cam) = 0;
+	// vertex attribute the model matrix is read from, four vec4 columns
+	static constexpr GLuint MODEL_LOCATION = 3;
+
+	Material(AlphaMode alpha_mode = AM_OPAQUE) : alpha_mode(alpha_mode), id(next_id++) { }
+	// binds program, textures and per-material uniforms; the model matrix is
+	// a per-instance vertex attribute
+	virtual void bind() = 0;
+
+	// non-instanced draw: the model matrix goes in the generic attribute value
+	void apply(const glm::mat4& model) {
+		bind();
+		for (GLuint i = 0; i < 4; ++i) {
+			glVertexAttrib4fv(MODEL_LOCATION + i, glm::value_ptr(model[i]));
+		}
+	}
+	// state the render queue sorts by
+	virtual GLuint program_handle() const = 0;
+	virtual GLuint texture_handle() const { return 0; }
 	AlphaMode alpha_mode = AM_OPAQUE;
+	// glTF doubleSided: both faces are drawn even in passes that cull back faces
+	bool double_sided = false;
+	uint32_t id;
+	static inline uint32_t next_id = 0;
 };
 
 struct SimpleColorMaterial : Material {
 	SimpleColorMaterial(glm::vec3 color) : color(color) {
 		if (shader_program == nullptr) {
 			shader_program = load_shader();
+			uniforms = Uniforms{
+				.color = shader_program->uniform<glm::vec3>("color"),
+			};
 		}
 	}
 
-	virtual void apply(glm::mat4 model, const Camera& cam) override {
+	virtual void bind() override {
 		shader_program->use();
+		shader_program->set(uniforms.color, color);
+	}
 
-		GLuint location = glGetUniformLocation(shader_program->handle, "model");
-		glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(model));
-		location = glGetUniformLocation(shader_program->handle, "view");
-		glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(cam.view()));
-		location = glGetUniformLocation(shader_program->handle, "project");
-		glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(cam.project()));
-		location = glGetUniformLocation(shader_program->handle, "color");
-		glUniform3fv(location, 1, glm::value_ptr(color));
+	virtual GLuint program_handle() const override {
+		return shader_program->handle;
 	}
 
 	static std::shared_ptr<ShaderProgram> load_shader() {
@@ -44,8 +64,13 @@ struct SimpleColorMaterial : Material {
 		return std::make_shared<ShaderProgram>(vert, frag);
 	}
 
+	struct Uniforms {
+		Uniform<glm::vec3> color;
+	};
+
 	glm::vec3 color;
 	static inline std::shared_ptr<ShaderProgram> shader_program = nullptr;
+	static inline Uniforms uniforms;
 };
 
 struct PhongMaterial : Material {
@@ -58,6 +83,12 @@ struct PhongMaterial : Material {
 	std::shared_ptr<PointLight> light;
 	static inline std::shared_ptr<ShaderProgram> default_shader_program = nullptr;
 
+	// camera, light and material constants come from the uniform blocks
+	struct Uniforms {
+		Uniform<int> material_index;
+	} uniforms;
+	uint32_t table_index;
+
 	PhongMaterial(
 		std::shared_ptr<ShaderProgram> shader_program, 
 		std::shared_ptr<Texture> texture, 
@@ -72,9 +103,36 @@ struct PhongMaterial : Material {
 		if (shader_program == nullptr && default_shader_program == nullptr) {
 			this->shader_program = load_shader();
 		}
+		if (this->shader_program != nullptr) {
+			resolve_uniforms();
+		}
+		table_index = MaterialTable::getInstance()->add(material_data());
 	}
 
-	virtual void apply(glm::mat4 model, const Camera &cam) override {
+	MaterialData material_data() const {
+		return MaterialData{
+			.k_ambient = k_ambient,
+			.k_diffuse = k_diffuse,
+			.k_specular = k_specular,
+			.phong_exponent = phong_exponent,
+			.recv_shadow = shadow_map == nullptr ? 0 : 1,
+			._pad = { 0, 0, 0 },
+		};
+	}
+
+	// call after changing the lighting constants
+	void upload_material_data() {
+		MaterialTable::getInstance()->set(table_index, material_data());
+	}
+
+	void resolve_uniforms() {
+		const ShaderProgram& program = *shader_program;
+		uniforms = Uniforms{
+			.material_index = program.uniform<int>("materialIndex"),
+		};
+	}
+
+	virtual void bind() override {
 		texture->use(GL_TEXTURE0);
 		if (shadow_map) {
 			shadow_map->use(GL_TEXTURE1);
@@ -83,42 +141,15 @@ struct PhongMaterial : Material {
 		assert(shader_program != nullptr);
 		shader_program->use();
 
-		GLuint location = glGetUniformLocation(shader_program->handle, "model");
-		glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(model));
-		location = glGetUniformLocation(shader_program->handle, "view");
-		glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(cam.view()));
-		location = glGetUniformLocation(shader_program->handle, "project");
-		glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(cam.project()));
-		location = glGetUniformLocation(shader_program->handle, "light.position");
-		glUniform3fv(location, 1, glm::value_ptr(light->position));
-		location = glGetUniformLocation(shader_program->handle, "light.color");
-		glUniform3fv(location, 1, glm::value_ptr(light->color));
-		location = glGetUniformLocation(shader_program->handle, "light.intensity");
-		glUniform1f(location, light->intensity);
-		location = glGetUniformLocation(shader_program->handle, "material.k_ambient");
-		glUniform1f(location, k_ambient);
-		location = glGetUniformLocation(shader_program->handle, "material.k_diffuse");
-		glUniform1f(location, k_diffuse);
-		location = glGetUniformLocation(shader_program->handle, "material.k_specular");
-		glUniform1f(location, k_specular);
-		location = glGetUniformLocation(shader_program->handle, "material.phong_exponent");
-		glUniform1f(location, phong_exponent);
-		location = glGetUniformLocation(shader_program->handle, "eye");
-		glUniform3fv(location, 1, glm::value_ptr(cam.pos));
-		location = glGetUniformLocation(shader_program->handle, "vp_light");
-		glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(light->light_cam.project() * light->light_cam.view()));
-		location = glGetUniformLocation(shader_program->handle, "ourTexture");
-		glUniform1i(location, 0);
-		location = glGetUniformLocation(shader_program->handle, "shadowMap");
-		glUniform1i(location, 1);
-		location = glGetUniformLocation(shader_program->handle, "zNear");
-		glUniform1f(location, light->light_cam.zNear);
-		location = glGetUniformLocation(shader_program->handle, "zFar");
-		glUniform1f(location, light->light_cam.zFar);
-		location = glGetUniformLocation(shader_program->handle, "lightSize");
-		glUniform1f(location, 1.0f);
-		location = glGetUniformLocation(shader_program->handle, "recvShadow");
-		glUniform1i(location, (shadow_map == nullptr ? 0 : 1));
+		shader_program->set(uniforms.material_index, static_cast<int>(table_index));
+	}
+
+	virtual GLuint program_handle() const override {
+		return shader_program->handle;
+	}
+
+	virtual GLuint texture_handle() const override {
+		return texture->handle;
 	}
 
 	static std::shared_ptr<ShaderProgram> load_shader() {
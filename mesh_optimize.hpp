@@ -0,0 +1,281 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Load-time reordering of indexed triangle lists for the post-transform
+// vertex cache, overdraw and vertex fetch. The cache is modelled as a FIFO of
+// VERTEX_CACHE_SIZE entries, which is what Tipsify optimizes for.
+constexpr uint32_t VERTEX_CACHE_SIZE = 16;
+
+// average cache miss ratio per triangle (0.5 at best on a regular grid, 3 at
+// worst) and per referenced vertex (1 at best)
+struct VertexCacheStats {
+	float acmr = .0f;
+	float atvr = .0f;
+};
+
+inline VertexCacheStats analyze_vertex_cache(const std::vector<uint32_t>& indices, size_t vertex_count, uint32_t cache_size = VERTEX_CACHE_SIZE) {
+	VertexCacheStats stats;
+	if (indices.size() < 3) {
+		return stats;
+	}
+	// a vertex is cached while fewer than cache_size misses followed its own
+	std::vector<uint64_t> loaded(vertex_count, 0);
+	std::vector<uint8_t> referenced(vertex_count, 0);
+	uint64_t misses = 0, unique = 0;
+	for (uint32_t v : indices) {
+		if (loaded[v] == 0 || misses - loaded[v] + 1 > cache_size) {
+			misses += 1;
+			loaded[v] = misses;
+		}
+		unique += !referenced[v];
+		referenced[v] = 1;
+	}
+	stats.acmr = static_cast<float>(misses) / static_cast<float>(indices.size() / 3);
+	stats.atvr = static_cast<float>(misses) / static_cast<float>(unique);
+	return stats;
+}
+
+// Maps every vertex to the first one with the same bytes, returns the number
+// of distinct vertices. Vertex must have no padding.
+template <typename Vertex>
+inline size_t weld_vertices(const std::vector<Vertex>& vertices, std::vector<uint32_t>& remap) {
+	std::vector<uint32_t> order(vertices.size());
+	std::iota(order.begin(), order.end(), 0);
+	auto compare = [&](uint32_t a, uint32_t b) {
+		return std::memcmp(&vertices[a], &vertices[b], sizeof(Vertex));
+	};
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return compare(a, b) < 0;
+	});
+	remap.resize(vertices.size());
+	size_t unique = 0;
+	for (size_t i = 0; i < order.size(); ++i) {
+		if (i > 0 && compare(order[i - 1], order[i]) == 0) {
+			remap[order[i]] = remap[order[i - 1]];
+		} else {
+			remap[order[i]] = order[i];
+			unique += 1;
+		}
+	}
+	return unique;
+}
+
+// drops triangles that use a vertex twice, they cover no pixels
+inline void remove_degenerate_triangles(std::vector<uint32_t>& indices) {
+	size_t out = 0;
+	for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+		uint32_t a = indices[t], b = indices[t + 1], c = indices[t + 2];
+		if (a == b || b == c || a == c) {
+			continue;
+		}
+		indices[out++] = a;
+		indices[out++] = b;
+		indices[out++] = c;
+	}
+	indices.resize(out);
+}
+
+// Tipsify (Sander, Nehab and Barczak 2007): fans around one vertex at a time
+// and moves on to the neighbour that is still in the cache and has the
+// fewest triangles left. Writes the first triangle of every run after a dead
+// end to clusters, which optimize_overdraw() may reorder freely.
+inline void optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertex_count, std::vector<uint32_t>& clusters,
+	uint32_t cache_size = VERTEX_CACHE_SIZE) {
+	clusters.clear();
+	size_t triangle_count = indices.size() / 3;
+	if (triangle_count == 0) {
+		return;
+	}
+	std::vector<uint32_t> tri_offsets(vertex_count + 1, 0), tri_list(triangle_count * 3);
+	for (size_t i = 0; i < triangle_count * 3; ++i) {
+		tri_offsets[indices[i] + 1] += 1;
+	}
+	std::partial_sum(tri_offsets.begin(), tri_offsets.end(), tri_offsets.begin());
+	std::vector<uint32_t> fill(tri_offsets.begin(), tri_offsets.end() - 1);
+	for (size_t i = 0; i < triangle_count * 3; ++i) {
+		tri_list[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	std::vector<uint32_t> live(vertex_count);
+	for (size_t v = 0; v < vertex_count; ++v) {
+		live[v] = tri_offsets[v + 1] - tri_offsets[v];
+	}
+	std::vector<uint64_t> cached_at(vertex_count, 0);
+	std::vector<uint8_t> emitted(triangle_count, 0);
+	std::vector<uint32_t> dead_end, candidates, result;
+	result.reserve(triangle_count * 3);
+	uint64_t time = cache_size + 1;
+	size_t cursor = 0;
+
+	auto skip_dead_end = [&]() -> int64_t {
+		while (!dead_end.empty()) {
+			uint32_t v = dead_end.back();
+			dead_end.pop_back();
+			if (live[v] > 0) {
+				return v;
+			}
+		}
+		while (cursor < vertex_count) {
+			if (live[cursor] > 0) {
+				return static_cast<int64_t>(cursor);
+			}
+			++cursor;
+		}
+		return -1;
+	};
+
+	int64_t fan = skip_dead_end();
+	bool new_cluster = true;
+	while (fan >= 0) {
+		candidates.clear();
+		for (uint32_t i = tri_offsets[fan]; i < tri_offsets[fan + 1]; ++i) {
+			uint32_t t = tri_list[i];
+			if (emitted[t]) {
+				continue;
+			}
+			if (new_cluster) {
+				clusters.push_back(static_cast<uint32_t>(result.size() / 3));
+				new_cluster = false;
+			}
+			for (int k = 0; k < 3; ++k) {
+				uint32_t v = indices[t * 3 + k];
+				result.push_back(v);
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				live[v] -= 1;
+				if (time - cached_at[v] > cache_size) {
+					cached_at[v] = time++;
+				}
+			}
+			emitted[t] = 1;
+		}
+
+		// the candidate still in the cache after its remaining fan, oldest first
+		int64_t next = -1;
+		int64_t best = -1;
+		for (uint32_t v : candidates) {
+			if (live[v] == 0) {
+				continue;
+			}
+			int64_t priority = 0;
+			if (time - cached_at[v] + 2 * live[v] <= cache_size) {
+				priority = static_cast<int64_t>(time - cached_at[v]);
+			}
+			if (priority > best) {
+				best = priority;
+				next = v;
+			}
+		}
+		if (next < 0) {
+			next = skip_dead_end();
+			new_cluster = true;
+		}
+		fan = next;
+	}
+	indices = std::move(result);
+}
+
+// Reorders the clusters of optimize_vertex_cache() so outward facing ones
+// come first (Sander et al.'s fast overdraw approximation): they are likely
+// to occlude the rest from most view points. Clusters whose cache
+// efficiency is already below threshold times the mesh's are split further
+// first, so there is more to sort.
+inline void optimize_overdraw(std::vector<uint32_t>& indices, const glm::vec3* positions, size_t vertex_count,
+	std::vector<uint32_t> clusters, float threshold = 1.05f, uint32_t cache_size = VERTEX_CACHE_SIZE) {
+	size_t triangle_count = indices.size() / 3;
+	if (triangle_count == 0 || clusters.empty()) {
+		return;
+	}
+	float mesh_acmr = analyze_vertex_cache(indices, vertex_count, cache_size).acmr;
+	// soft boundaries: restart wherever a cluster's own miss ratio, counted
+	// from an empty cache, is good enough
+	std::vector<uint32_t> split;
+	std::vector<uint64_t> loaded(vertex_count, 0);
+	uint64_t misses = 0;
+	for (size_t c = 0; c < clusters.size(); ++c) {
+		uint32_t first = clusters[c];
+		uint32_t last = c + 1 < clusters.size() ? clusters[c + 1] : static_cast<uint32_t>(triangle_count);
+		split.push_back(first);
+		uint64_t cluster_misses = 0, start = first, cache_start = misses;
+		for (uint32_t t = first; t < last; ++t) {
+			for (int k = 0; k < 3; ++k) {
+				uint32_t v = indices[t * 3 + k];
+				if (loaded[v] <= cache_start || misses - loaded[v] + 1 > cache_size) {
+					misses += 1;
+					cluster_misses += 1;
+					loaded[v] = misses;
+				}
+			}
+			uint64_t triangles = t + 1 - start;
+			if (t + 1 < last && static_cast<float>(cluster_misses) <= threshold * mesh_acmr * static_cast<float>(triangles)) {
+				split.push_back(t + 1);
+				start = t + 1;
+				cache_start = misses;
+				cluster_misses = 0;
+			}
+		}
+	}
+
+	glm::vec3 mesh_centroid(.0f);
+	float mesh_area = .0f;
+	struct Cluster {
+		uint32_t first, last;
+		float sort;
+	};
+	std::vector<Cluster> sorted(split.size());
+	std::vector<glm::vec3> centroid(split.size(), glm::vec3(.0f)), normal(split.size(), glm::vec3(.0f));
+	std::vector<float> area(split.size(), .0f);
+	for (size_t c = 0; c < split.size(); ++c) {
+		sorted[c].first = split[c];
+		sorted[c].last = c + 1 < split.size() ? split[c + 1] : static_cast<uint32_t>(triangle_count);
+		for (uint32_t t = sorted[c].first; t < sorted[c].last; ++t) {
+			glm::vec3 p0 = positions[indices[t * 3]], p1 = positions[indices[t * 3 + 1]], p2 = positions[indices[t * 3 + 2]];
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float a = glm::length(n) * 0.5f;
+			centroid[c] += (p0 + p1 + p2) / 3.0f * a;
+			normal[c] += n;
+			area[c] += a;
+		}
+		mesh_centroid += centroid[c];
+		mesh_area += area[c];
+		if (area[c] > .0f) {
+			centroid[c] /= area[c];
+		}
+	}
+	if (mesh_area > .0f) {
+		mesh_centroid /= mesh_area;
+	}
+	for (size_t c = 0; c < split.size(); ++c) {
+		float length = glm::length(normal[c]);
+		sorted[c].sort = length > .0f ? glm::dot(centroid[c] - mesh_centroid, normal[c] / length) : .0f;
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& a, const Cluster& b) {
+		return a.sort > b.sort;
+	});
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+	for (const Cluster& cluster : sorted) {
+		result.insert(result.end(), indices.begin() + cluster.first * 3, indices.begin() + cluster.last * 3);
+	}
+	indices = std::move(result);
+}
+
+// Renumbers vertices in order of first use, so fetches walk the vertex buffer
+// forward. Unreferenced vertices are dropped; returns the number kept and
+// remap[old] is the new index or UINT32_MAX.
+inline size_t optimize_vertex_fetch(std::vector<uint32_t>& indices, size_t vertex_count, std::vector<uint32_t>& remap) {
+	remap.assign(vertex_count, UINT32_MAX);
+	uint32_t next = 0;
+	for (uint32_t& v : indices) {
+		if (remap[v] == UINT32_MAX) {
+			remap[v] = next++;
+		}
+		v = remap[v];
+	}
+	return next;
+}
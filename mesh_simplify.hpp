@@ -0,0 +1,243 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Garland-Heckbert error quadric: the sum of squared distances to a set of
+// planes, as a symmetric 4x4 matrix
+struct Quadric {
+	double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+
+	// plane n.p + d = 0 with unit n
+	static Quadric plane(const glm::dvec3& n, double d) {
+		return Quadric{ n.x * n.x, n.x * n.y, n.x * n.z, n.x * d, n.y * n.y, n.y * n.z, n.y * d, n.z * n.z, n.z * d, d * d };
+	}
+
+	Quadric& operator+=(const Quadric& q) {
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2;
+		bc += q.bc; bd += q.bd; c2 += q.c2; cd += q.cd; d2 += q.d2;
+		return *this;
+	}
+
+	double error(const glm::dvec3& p) const {
+		double e = a2 * p.x * p.x + 2 * ab * p.x * p.y + 2 * ac * p.x * p.z + 2 * ad * p.x
+			+ b2 * p.y * p.y + 2 * bc * p.y * p.z + 2 * bd * p.y
+			+ c2 * p.z * p.z + 2 * cd * p.z + d2;
+		return std::max(e, 0.0);
+	}
+};
+
+// Simplifies a triangle list by collapsing edges onto one of their endpoints,
+// cheapest quadric error first, so the result indexes the same vertices.
+// Vertices on open borders and on seams, i.e. sharing their position with
+// another vertex, never move. Each pass collapses an independent set of
+// edges, passes repeat until target_index_count is reached or the next
+// collapse would cost more than max_error. Errors are distances relative to
+// the mesh's extent; the largest one accepted is written to error.
+inline std::vector<uint32_t> simplify_mesh(const glm::vec3* positions, size_t vertex_count, const std::vector<uint32_t>& indices,
+	size_t target_index_count, float max_error, float& error) {
+	error = .0f;
+	std::vector<uint32_t> result(indices.begin(), indices.begin() + indices.size() / 3 * 3);
+	if (vertex_count == 0 || result.empty()) {
+		return result;
+	}
+	glm::vec3 lo(positions[0]), hi(positions[0]);
+	for (size_t v = 1; v < vertex_count; ++v) {
+		lo = glm::min(lo, positions[v]);
+		hi = glm::max(hi, positions[v]);
+	}
+	double extent = glm::length(glm::dvec3(hi - lo));
+	if (extent <= .0) {
+		return result;
+	}
+	double max_cost = (max_error * extent) * (max_error * extent);
+
+	// weld equal positions; welded groups of several vertices are seams
+	std::vector<uint32_t> order(vertex_count), weld(vertex_count);
+	std::iota(order.begin(), order.end(), 0);
+	auto less = [&](uint32_t a, uint32_t b) {
+		const glm::vec3& p = positions[a];
+		const glm::vec3& q = positions[b];
+		return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z < q.z;
+	};
+	std::sort(order.begin(), order.end(), less);
+	std::vector<uint8_t> locked(vertex_count, 0);
+	for (size_t i = 0; i < vertex_count;) {
+		size_t j = i + 1;
+		while (j < vertex_count && positions[order[j]] == positions[order[i]]) {
+			++j;
+		}
+		for (size_t k = i; k < j; ++k) {
+			weld[order[k]] = order[i];
+			locked[order[k]] = j - i > 1;
+		}
+		i = j;
+	}
+
+	// edges of the welded mesh not shared by exactly two triangles are borders
+	auto edge_key = [](uint32_t a, uint32_t b) {
+		return (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+	};
+	std::vector<uint64_t> edges;
+	edges.reserve(result.size());
+	for (size_t t = 0; t < result.size(); t += 3) {
+		for (int e = 0; e < 3; ++e) {
+			edges.push_back(edge_key(weld[result[t + e]], weld[result[t + (e + 1) % 3]]));
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	std::vector<uint8_t> border(vertex_count, 0);
+	for (size_t i = 0; i < edges.size();) {
+		size_t j = i + 1;
+		while (j < edges.size() && edges[j] == edges[i]) {
+			++j;
+		}
+		if (j - i != 2) {
+			border[edges[i] >> 32] = 1;
+			border[edges[i] & 0xffffffff] = 1;
+		}
+		i = j;
+	}
+	for (size_t v = 0; v < vertex_count; ++v) {
+		locked[v] |= border[weld[v]];
+	}
+
+	auto position = [&](uint32_t v) {
+		return glm::dvec3(positions[v]);
+	};
+	std::vector<Quadric> quadrics(vertex_count);
+	for (size_t t = 0; t < result.size(); t += 3) {
+		glm::dvec3 p0 = position(result[t]), p1 = position(result[t + 1]), p2 = position(result[t + 2]);
+		glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+		double length = glm::length(n);
+		if (length <= .0) {
+			continue;
+		}
+		n /= length;
+		Quadric q = Quadric::plane(n, -glm::dot(n, p0));
+		for (int k = 0; k < 3; ++k) {
+			quadrics[result[t + k]] += q;
+		}
+	}
+
+	struct Collapse {
+		uint32_t from, to;
+		double cost;
+	};
+	std::vector<Collapse> collapses;
+	std::vector<uint32_t> tri_offsets(vertex_count + 1), tri_list;
+	std::vector<uint32_t> remap(vertex_count);
+	std::vector<uint8_t> touched(vertex_count);
+	double max_accepted = .0;
+	size_t target_triangles = target_index_count / 3;
+
+	while (result.size() / 3 > target_triangles) {
+		size_t triangles = result.size() / 3;
+
+		// triangles around each vertex
+		std::fill(tri_offsets.begin(), tri_offsets.end(), 0);
+		for (uint32_t v : result) {
+			tri_offsets[v + 1] += 1;
+		}
+		std::partial_sum(tri_offsets.begin(), tri_offsets.end(), tri_offsets.begin());
+		tri_list.resize(result.size());
+		std::vector<uint32_t> fill(tri_offsets.begin(), tri_offsets.end() - 1);
+		for (size_t i = 0; i < result.size(); ++i) {
+			tri_list[fill[result[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+
+		// cheapest direction of every edge that may collapse at all
+		edges.clear();
+		for (size_t t = 0; t < result.size(); t += 3) {
+			for (int e = 0; e < 3; ++e) {
+				edges.push_back(edge_key(result[t + e], result[t + (e + 1) % 3]));
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+		collapses.clear();
+		for (uint64_t edge : edges) {
+			uint32_t a = static_cast<uint32_t>(edge >> 32), b = static_cast<uint32_t>(edge & 0xffffffff);
+			if (locked[a] && locked[b]) {
+				continue;
+			}
+			Quadric q = quadrics[a];
+			q += quadrics[b];
+			double to_b = locked[a] ? INFINITY : q.error(position(b));
+			double to_a = locked[b] ? INFINITY : q.error(position(a));
+			collapses.push_back(to_b <= to_a ? Collapse{ a, b, to_b } : Collapse{ b, a, to_a });
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) {
+			return x.cost < y.cost;
+		});
+
+		// moving from onto to must not turn any remaining triangle around
+		auto flips = [&](uint32_t from, uint32_t to) {
+			for (uint32_t i = tri_offsets[from]; i < tri_offsets[from + 1]; ++i) {
+				const uint32_t* tri = &result[tri_list[i] * 3];
+				if (tri[0] == to || tri[1] == to || tri[2] == to) {
+					continue;
+				}
+				glm::dvec3 p[3], q[3];
+				for (int k = 0; k < 3; ++k) {
+					p[k] = position(tri[k]);
+					q[k] = tri[k] == from ? position(to) : p[k];
+				}
+				glm::dvec3 n0 = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::dvec3 n1 = glm::cross(q[1] - q[0], q[2] - q[0]);
+				if (glm::dot(n0, n1) <= 0.25 * glm::length(n0) * glm::length(n1)) {
+					return true;
+				}
+			}
+			return false;
+		};
+		auto touch_ring = [&](uint32_t v) {
+			for (uint32_t i = tri_offsets[v]; i < tri_offsets[v + 1]; ++i) {
+				const uint32_t* tri = &result[tri_list[i] * 3];
+				touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+			}
+		};
+
+		std::iota(remap.begin(), remap.end(), 0);
+		std::fill(touched.begin(), touched.end(), 0);
+		size_t removed = 0, collapsed = 0;
+		for (const Collapse& c : collapses) {
+			if (c.cost > max_cost || removed >= triangles - target_triangles) {
+				break;
+			}
+			if (touched[c.from] || touched[c.to] || flips(c.from, c.to)) {
+				continue;
+			}
+			for (uint32_t i = tri_offsets[c.from]; i < tri_offsets[c.from + 1]; ++i) {
+				const uint32_t* tri = &result[tri_list[i] * 3];
+				removed += tri[0] == c.to || tri[1] == c.to || tri[2] == c.to;
+			}
+			touch_ring(c.from);
+			touch_ring(c.to);
+			remap[c.from] = c.to;
+			quadrics[c.to] += quadrics[c.from];
+			max_accepted = std::max(max_accepted, c.cost);
+			collapsed += 1;
+		}
+		if (collapsed == 0) {
+			break;
+		}
+
+		size_t out = 0;
+		for (size_t t = 0; t < result.size(); t += 3) {
+			uint32_t a = remap[result[t]], b = remap[result[t + 1]], c = remap[result[t + 2]];
+			if (a == b || b == c || a == c) {
+				continue;
+			}
+			result[out++] = a;
+			result[out++] = b;
+			result[out++] = c;
+		}
+		result.resize(out);
+	}
+	error = static_cast<float>(std::sqrt(max_accepted) / extent);
+	return result;
+}
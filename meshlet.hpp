@@ -0,0 +1,307 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "gl_state.hpp"
+#include "shader.hpp"
+
+// A cluster of a primitive's triangles: a contiguous index range with a
+// bounding sphere and a normal cone in the primitive's local space. The
+// cluster faces away from every eye p with
+// dot(center - p, axis) >= cutoff * |center - p| + radius.
+struct Meshlet {
+	static constexpr uint32_t MAX_VERTICES = 64;
+	static constexpr uint32_t MAX_TRIANGLES = 124;
+
+	uint32_t first_index;
+	uint32_t index_count;
+	glm::vec4 sphere;  // center, radius
+	glm::vec4 cone;  // axis, cutoff; a cutoff of 1 never culls
+};
+
+// Splits a triangle list into meshlets of at most MAX_VERTICES distinct
+// vertices and MAX_TRIANGLES triangles and reorders indices in place, so
+// every meshlet is a contiguous range. Meshlets grow greedily by the
+// neighbouring triangle that adds the fewest new vertices, the nearest to the
+// meshlet's centroid on ties, and end when none fits or none is adjacent.
+// first_index is relative to indices.
+inline std::vector<Meshlet> build_meshlets(const glm::vec3* positions, size_t vertex_count, uint32_t* indices, size_t index_count) {
+	std::vector<Meshlet> meshlets;
+	size_t triangle_count = index_count / 3;
+	if (triangle_count == 0) {
+		return meshlets;
+	}
+
+	std::vector<uint32_t> tri_offsets(vertex_count + 1, 0), tri_list(triangle_count * 3);
+	for (size_t i = 0; i < triangle_count * 3; ++i) {
+		tri_offsets[indices[i] + 1] += 1;
+	}
+	for (size_t v = 0; v < vertex_count; ++v) {
+		tri_offsets[v + 1] += tri_offsets[v];
+	}
+	std::vector<uint32_t> fill(tri_offsets.begin(), tri_offsets.end() - 1);
+	for (size_t i = 0; i < triangle_count * 3; ++i) {
+		tri_list[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	std::vector<uint32_t> reordered;
+	reordered.reserve(triangle_count * 3);
+	std::vector<uint8_t> used(triangle_count, 0);
+	// stamp[v] == meshlet number + 1 while v is in the current meshlet
+	std::vector<uint32_t> stamp(vertex_count, 0);
+	std::vector<uint32_t> vertices;
+	std::vector<uint32_t> triangles;
+	size_t seed = 0;
+
+	auto new_vertices = [&](uint32_t t, uint32_t mark) {
+		return (stamp[indices[t * 3]] != mark) + (stamp[indices[t * 3 + 1]] != mark) + (stamp[indices[t * 3 + 2]] != mark);
+	};
+	auto centroid = [&](uint32_t t) {
+		return (positions[indices[t * 3]] + positions[indices[t * 3 + 1]] + positions[indices[t * 3 + 2]]) / 3.0f;
+	};
+
+	while (reordered.size() < triangle_count * 3) {
+		uint32_t mark = static_cast<uint32_t>(meshlets.size() + 1);
+		vertices.clear();
+		triangles.clear();
+		glm::vec3 sum(.0f);
+		while (triangles.size() < Meshlet::MAX_TRIANGLES) {
+			uint32_t best = UINT32_MAX, best_new = 4;
+			float best_distance = INFINITY;
+			if (triangles.empty()) {
+				while (used[seed]) {
+					++seed;
+				}
+				best = static_cast<uint32_t>(seed);
+				best_new = 3;
+			} else {
+				glm::vec3 center = sum / static_cast<float>(triangles.size());
+				for (uint32_t v : vertices) {
+					for (uint32_t i = tri_offsets[v]; i < tri_offsets[v + 1]; ++i) {
+						uint32_t t = tri_list[i];
+						if (used[t]) {
+							continue;
+						}
+						uint32_t added = new_vertices(t, mark);
+						if (added > best_new) {
+							continue;
+						}
+						glm::vec3 offset = centroid(t) - center;
+						float distance = glm::dot(offset, offset);
+						if (added < best_new || distance < best_distance) {
+							best = t;
+							best_new = added;
+							best_distance = distance;
+						}
+					}
+				}
+			}
+			if (best == UINT32_MAX || vertices.size() + best_new > Meshlet::MAX_VERTICES) {
+				break;
+			}
+			used[best] = 1;
+			triangles.push_back(best);
+			sum += centroid(best);
+			for (int k = 0; k < 3; ++k) {
+				uint32_t v = indices[best * 3 + k];
+				if (stamp[v] != mark) {
+					stamp[v] = mark;
+					vertices.push_back(v);
+				}
+			}
+		}
+
+		Meshlet meshlet{ static_cast<uint32_t>(reordered.size()), static_cast<uint32_t>(triangles.size() * 3), glm::vec4(.0f), glm::vec4(.0f, .0f, .0f, 1.0f) };
+		glm::vec3 lo(positions[vertices[0]]), hi(positions[vertices[0]]);
+		for (uint32_t v : vertices) {
+			lo = glm::min(lo, positions[v]);
+			hi = glm::max(hi, positions[v]);
+		}
+		glm::vec3 center = (lo + hi) * 0.5f;
+		float radius = .0f;
+		for (uint32_t v : vertices) {
+			radius = std::max(radius, glm::length(positions[v] - center));
+		}
+		meshlet.sphere = glm::vec4(center, radius);
+
+		// the cone is only kept if every triangle is within 90 degrees of the axis
+		std::vector<glm::vec3> normals;
+		normals.reserve(triangles.size());
+		glm::vec3 axis(.0f);
+		for (uint32_t t : triangles) {
+			for (int k = 0; k < 3; ++k) {
+				reordered.push_back(indices[t * 3 + k]);
+			}
+			glm::vec3 p0 = positions[indices[t * 3]], p1 = positions[indices[t * 3 + 1]], p2 = positions[indices[t * 3 + 2]];
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float length = glm::length(n);
+			if (length > .0f) {
+				normals.push_back(n / length);
+				axis += n / length;
+			}
+		}
+		float axis_length = glm::length(axis);
+		if (axis_length > .0f) {
+			axis /= axis_length;
+			float min_dot = 1.0f;
+			for (const glm::vec3& n : normals) {
+				min_dot = std::min(min_dot, glm::dot(axis, n));
+			}
+			if (min_dot > .0f) {
+				meshlet.cone = glm::vec4(axis, std::sqrt(1.0f - min_dot * min_dot));
+			}
+		}
+		meshlets.push_back(meshlet);
+	}
+	std::copy(reordered.begin(), reordered.end(), indices);
+	return meshlets;
+}
+
+// shader storage bindings of meshlet_cull.comp
+enum MeshletStorageBinding {
+	MSB_INSTANCES = 0,
+	MSB_COMMANDS = 1,
+	MSB_JOBS = 2,
+	MSB_VIEW = 3,
+	MSB_MESHLETS = 4,
+	MSB_STATS = 5,
+};
+
+// Culls meshlet draws on the GPU with meshlet_cull.comp. Every job is an
+// indirect command drawing one meshlet of one instance; a meshlet outside the
+// frustum, or facing away from the eye of a view that culls back faces, gets
+// an instance count of 0. GL 4.3
+// has no indirect draw count, so the culled commands stay in their batch.
+// Without compute shaders supported() is false and primitives are drawn
+// whole.
+struct MeshletCuller {
+	// local_size_x of meshlet_cull.comp
+	static constexpr uint32_t GROUP_SIZE = 64;
+
+	MeshletCuller();
+	~MeshletCuller();
+	MeshletCuller(const MeshletCuller&) = delete;
+	MeshletCuller& operator=(const MeshletCuller&) = delete;
+
+	bool supported() const {
+		return program != nullptr;
+	}
+
+	// the sphere and cone of every meshlet of the scene, in table order
+	void upload(const std::vector<Meshlet>& table);
+	// jobs are (command, meshlet) pairs at jobs_offset in buffer, view the six
+	// frustum planes and the eye at view_offset; offsets are multiples of 16
+	void cull(GLuint buffer, size_t command_offset, size_t jobs_offset, size_t view_offset, uint32_t job_count);
+	// reads the culled counters back, so it stalls; call outside the frame
+	void print_stats(std::ostream& os);
+
+	uint64_t tested = 0;
+private:
+	std::unique_ptr<ShaderProgram> program;
+	struct Uniforms {
+		Uniform<int> command_base, job_base, view_base, job_count;
+	} uniforms;
+	GLuint meshlet_buffer = 0;
+	GLuint stats_buffer = 0;
+};
+
+MeshletCuller::MeshletCuller() {
+	if (GLVersion.major < 4 || (GLVersion.major == 4 && GLVersion.minor < 3)) {
+		std::cout << "meshlet culling: needs GL 4.3 compute shaders, primitives are drawn whole" << std::endl;
+		return;
+	}
+	try {
+		Shader comp("meshlet_cull.comp", GL_COMPUTE_SHADER);
+		if (comp.success != GL_TRUE) {
+			throw std::runtime_error("failed to compile meshlet_cull.comp");
+		}
+		auto linked = std::make_unique<ShaderProgram>(comp);
+		if (!linked->success) {
+			throw std::runtime_error("failed to link meshlet_cull.comp");
+		}
+		program = std::move(linked);
+	} catch (const std::runtime_error& e) {
+		std::cerr << "meshlet culling: " << e.what() << ", primitives are drawn whole" << std::endl;
+		return;
+	}
+	uniforms.command_base = program->uniform<int>("command_base");
+	uniforms.job_base = program->uniform<int>("job_base");
+	uniforms.view_base = program->uniform<int>("view_base");
+	uniforms.job_count = program->uniform<int>("job_count");
+
+	uint32_t zero[2] = { 0, 0 };
+	glGenBuffers(1, &stats_buffer);
+	GLState::getInstance()->bind_buffer(GL_SHADER_STORAGE_BUFFER, stats_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(zero), zero, GL_DYNAMIC_COPY);
+}
+
+MeshletCuller::~MeshletCuller() {
+	if (meshlet_buffer != 0) {
+		glDeleteBuffers(1, &meshlet_buffer);
+	}
+	if (stats_buffer != 0) {
+		glDeleteBuffers(1, &stats_buffer);
+	}
+	GLState::getInstance()->invalidate();
+}
+
+void MeshletCuller::upload(const std::vector<Meshlet>& table) {
+	if (!supported() || table.empty()) {
+		return;
+	}
+	std::vector<glm::vec4> data;
+	data.reserve(table.size() * 2);
+	for (const Meshlet& meshlet : table) {
+		data.push_back(meshlet.sphere);
+		data.push_back(meshlet.cone);
+	}
+	if (meshlet_buffer == 0) {
+		glGenBuffers(1, &meshlet_buffer);
+	}
+	GLState::getInstance()->bind_buffer(GL_SHADER_STORAGE_BUFFER, meshlet_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, data.size() * sizeof(glm::vec4), data.data(), GL_STATIC_DRAW);
+	std::cout << "meshlets: " << table.size() << ", " << data.size() * sizeof(glm::vec4) / 1024 << " KiB of bounds" << std::endl;
+}
+
+void MeshletCuller::cull(GLuint buffer, size_t command_offset, size_t jobs_offset, size_t view_offset, uint32_t job_count) {
+	if (!supported() || meshlet_buffer == 0 || job_count == 0) {
+		return;
+	}
+	auto* gl_state = GLState::getInstance();
+	program->use();
+	program->set(uniforms.command_base, static_cast<int>(command_offset / sizeof(uint32_t)));
+	program->set(uniforms.job_base, static_cast<int>(jobs_offset / sizeof(glm::uvec2)));
+	program->set(uniforms.view_base, static_cast<int>(view_offset / sizeof(glm::vec4)));
+	program->set(uniforms.job_count, static_cast<int>(job_count));
+	// instances, commands, jobs and the view all alias the stream buffer
+	gl_state->bind_buffer_base(GL_SHADER_STORAGE_BUFFER, MSB_INSTANCES, buffer);
+	gl_state->bind_buffer_base(GL_SHADER_STORAGE_BUFFER, MSB_COMMANDS, buffer);
+	gl_state->bind_buffer_base(GL_SHADER_STORAGE_BUFFER, MSB_JOBS, buffer);
+	gl_state->bind_buffer_base(GL_SHADER_STORAGE_BUFFER, MSB_VIEW, buffer);
+	gl_state->bind_buffer_base(GL_SHADER_STORAGE_BUFFER, MSB_MESHLETS, meshlet_buffer);
+	gl_state->bind_buffer_base(GL_SHADER_STORAGE_BUFFER, MSB_STATS, stats_buffer);
+	glDispatchCompute((job_count + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+	// later culling stages read the commands as storage, the draws as commands
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+	tested += job_count;
+}
+
+void MeshletCuller::print_stats(std::ostream& os) {
+	if (!supported()) {
+		os << "meshlet culling: unsupported" << std::endl;
+		return;
+	}
+	uint32_t culled[2] = { 0, 0 };
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	GLState::getInstance()->bind_buffer(GL_SHADER_STORAGE_BUFFER, stats_buffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(culled), culled);
+	os << "meshlet culling: " << tested << " meshlet draws, " << culled[0] << " outside the frustum, "
+		<< culled[1] << " backfacing" << std::endl;
+}
@@ -0,0 +1,702 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "gltf_scene.hpp"
+#include "image_loader.hpp"
+#include "mapped_file.hpp"
+
+// A GLTFScene cooked into one file that loads without parsing JSON,
+// decoding images or processing geometry: the vertex and index buffers as
+// GeometryPool uploads them, primitives with their LODs and meshlets,
+// material and texture tables, the flattened scene graph, instances, and
+// every image with its whole mip chain. Sections are 64 byte aligned and
+// stored in the cooking machine's layout; loading maps the file and hands
+// the sections to GL directly.
+//
+// A cache is only used when its version and geometry flags match and the
+// hash of the glTF file and every file it references is unchanged;
+// anything else falls back to loading the glTF.
+struct SceneCache {
+	static constexpr uint32_t VERSION = 2;
+	static constexpr uint64_t ALIGNMENT = 64;
+
+	// GLTFScene settings that change what is cooked
+	enum Flag : uint32_t {
+		SCF_OPTIMIZE = 1 << 0,
+		SCF_QUANTIZE = 1 << 1,
+		SCF_LODS = 1 << 2,
+		SCF_MESHLETS = 1 << 3,
+	};
+
+	enum SectionId : uint32_t {
+		SC_DEPENDENCIES,  // referenced files, relative to the glTF, each null terminated
+		SC_NODE_NAMES,  // per glTF node, each null terminated
+		SC_VERTICES,  // QuantizedVertex or Vertex by SCF_QUANTIZE
+		SC_INDICES,  // uint32_t
+		SC_NARROW_INDICES,  // uint16_t
+		SC_PRIMITIVES,  // PrimitiveRecord
+		SC_LODS,  // GeometryLod
+		SC_MESHLETS,  // Meshlet, in primitive space
+		SC_MESHES,  // MeshRecord
+		SC_GRAPH,  // GraphRecord, in flat order
+		SC_INSTANCE_RANGES,  // InstanceRange per glTF node
+		SC_INSTANCES,  // glm::mat4
+		SC_MATERIALS,  // MaterialRecord
+		SC_TEXTURES,  // TextureRecord
+		SC_IMAGES,  // ImageRecord
+		SC_TEXELS,  // mip levels of every image, largest first
+		SC_COUNT,
+	};
+
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t flags;
+		uint32_t section_count;
+		uint64_t source_hash;
+		int32_t default_scene;
+		uint32_t reserved;
+	};
+	struct Section {
+		uint64_t offset;
+		uint64_t size;
+	};
+	struct PrimitiveRecord {
+		uint32_t mode;
+		uint32_t material;
+		uint32_t first_lod, lod_count;
+		uint32_t first_meshlet, meshlet_count;
+		AABB bounds;
+		AABB vertex_bounds;
+	};
+	// GLTFMesh creates its primitives in order, so they are a contiguous range
+	struct MeshRecord {
+		uint32_t first_primitive, primitive_count;
+	};
+	struct GraphRecord {
+		int32_t parent;
+		uint32_t subtree_end;
+		int32_t node;
+		int32_t mesh;
+		glm::mat4 local;
+	};
+	struct InstanceRange {
+		uint32_t first, count;
+	};
+	enum AlphaMode : uint32_t { AM_OPAQUE, AM_MASK, AM_BLEND };
+	struct MaterialRecord {
+		int32_t texture;
+		uint32_t alpha_mode;
+		uint32_t double_sided;
+	};
+	struct TextureRecord {
+		int32_t image;
+		int32_t wrap_s, wrap_t, min_filter, mag_filter;
+	};
+	// levels of width x height halved down to 1x1, or only the first if the
+	// mip chain was not built, starting at offset into SC_TEXELS
+	struct ImageRecord {
+		uint32_t width, height;
+		uint32_t components, pixel_type;
+		uint32_t levels, reserved;
+		uint64_t offset;
+	};
+
+	static uint32_t flags_of(bool optimize, bool quantize, bool lods, bool meshlets);
+	static uint32_t flags_of(const GLTFScene& scene) {
+		return flags_of(scene.optimize_geometry, scene.quantize_vertices, scene.generate_lods, scene.generate_meshlets);
+	}
+	// the cache path that belongs to a glTF file: its extension becomes .qglc
+	static std::string path_for(const std::string& source);
+	// loads source on the CPU and writes it to output; false with err set on failure
+	static bool cook(const std::string& source, const std::string& output, uint32_t flags, std::string& err);
+
+	// maps path and checks it against source; false with err saying why the
+	// cache cannot be used
+	bool open(const std::string& path, const std::string& source, uint32_t flags, std::string& err);
+	// everything but GL: fills scene's model metadata, primitives, meshes,
+	// instances, scene graph and draw items
+	void restore(GLTFScene& scene) const;
+	// GL side of restore(): materials, textures from the cooked mip chains,
+	// geometry and meshlets; closes the file
+	void upload(GLTFScene& scene, std::shared_ptr<ShaderProgram> shader_program, std::shared_ptr<PointLight> light,
+		std::shared_ptr<Texture> shadow_map);
+
+private:
+	static constexpr char MAGIC[4] = { 'Q', 'G', 'L', 'C' };
+
+	template <typename T>
+	std::span<const T> section(SectionId id) const {
+		static_assert(std::is_trivially_copyable_v<T>);
+		return std::span<const T>(reinterpret_cast<const T*>(file.data() + sections[id].offset), sections[id].size / sizeof(T));
+	}
+	// null terminated strings of a section
+	std::vector<std::string> strings(SectionId id) const;
+	// checks every index and range in the records against what it points
+	// into, so restore() and upload() can use them unchecked; false with err
+	// naming the first bad record
+	bool validate_records(std::string& err) const;
+	static uint64_t hash_sources(const std::string& source, const std::vector<std::string>& dependencies, std::string& err);
+
+	MappedFile file;
+	Header header{};
+	Section sections[SC_COUNT]{};
+};
+
+uint32_t SceneCache::flags_of(bool optimize, bool quantize, bool lods, bool meshlets) {
+	return (optimize ? SCF_OPTIMIZE : 0u) | (quantize ? SCF_QUANTIZE : 0u) | (lods ? SCF_LODS : 0u) | (meshlets ? SCF_MESHLETS : 0u);
+}
+
+std::string SceneCache::path_for(const std::string& source) {
+	return std::filesystem::path(source).replace_extension(".qglc").string();
+}
+
+// FNV-1a over 8 byte words, chained through every file in order
+uint64_t SceneCache::hash_sources(const std::string& source, const std::vector<std::string>& dependencies, std::string& err) {
+	uint64_t hash = 14695981039346656037ull;
+	std::string base_dir = tinygltf::GetBaseDir(source);
+	for (size_t f = 0; f <= dependencies.size(); ++f) {
+		std::string path = f == 0 ? source : tinygltf::JoinPath(base_dir, dependencies[f - 1]);
+		MappedFile mapped(path);
+		if (!mapped.is_open()) {
+			err = "cannot read " + path;
+			return 0;
+		}
+		const unsigned char* data = mapped.data();
+		size_t words = mapped.size() / 8;
+		for (size_t i = 0; i < words; ++i) {
+			uint64_t word;
+			std::memcpy(&word, data + i * 8, 8);
+			hash = (hash ^ word) * 1099511628211ull;
+		}
+		for (size_t i = words * 8; i < mapped.size(); ++i) {
+			hash = (hash ^ data[i]) * 1099511628211ull;
+		}
+		hash = (hash ^ mapped.size()) * 1099511628211ull;
+	}
+	return hash;
+}
+
+bool SceneCache::cook(const std::string& source, const std::string& output, uint32_t flags, std::string& err) {
+	GLTFScene scene;
+	scene.optimize_geometry = flags & SCF_OPTIMIZE;
+	scene.quantize_vertices = flags & SCF_QUANTIZE;
+	scene.generate_lods = flags & SCF_LODS;
+	scene.generate_meshlets = flags & SCF_MESHLETS;
+	DeferredImageLoader images;
+	if (!scene.parse(source, images)) {
+		err = "failed to load " + source;
+		return false;
+	}
+	images.decode(scene.model, scene.err);
+	scene.build_geometry();
+	scene.graph.build(scene.model, std::max(scene.model.defaultScene, 0));
+	const tinygltf::Model& model = scene.model;
+
+	std::vector<std::string> dependencies;
+	auto depend = [&](const std::string& uri) {
+		std::string path;
+		if (!uri.empty() && !tinygltf::IsDataURI(uri) && tinygltf::URIDecode(uri, &path, nullptr)) {
+			dependencies.push_back(path);
+		}
+	};
+	for (const tinygltf::Buffer& buffer : model.buffers) {
+		depend(buffer.uri);
+	}
+	for (const tinygltf::Image& image : model.images) {
+		depend(image.uri);
+	}
+
+	std::ofstream out(output, std::ios::binary | std::ios::trunc);
+	if (!out) {
+		err = "cannot write " + output;
+		return false;
+	}
+	Header header{};
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.flags = flags;
+	header.section_count = SC_COUNT;
+	header.source_hash = hash_sources(source, dependencies, err);
+	header.default_scene = model.defaultScene;
+	if (!err.empty()) {
+		return false;
+	}
+	Section sections[SC_COUNT]{};
+	uint64_t offset = sizeof(Header) + sizeof(sections);
+	out.seekp(offset);
+	auto write = [&](SectionId id, const void* data, size_t size) {
+		uint64_t aligned = (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+		static const char zeros[ALIGNMENT] = {};
+		out.write(zeros, aligned - offset);
+		out.write(static_cast<const char*>(data), size);
+		sections[id] = Section{ aligned, size };
+		offset = aligned + size;
+	};
+	auto write_vector = [&](SectionId id, const auto& v) {
+		write(id, v.data(), v.size() * sizeof(v[0]));
+	};
+	auto write_strings = [&](SectionId id, const std::vector<std::string>& v) {
+		std::string joined;
+		for (const std::string& s : v) {
+			joined.append(s.c_str(), s.size() + 1);
+		}
+		write(id, joined.data(), joined.size());
+	};
+
+	write_strings(SC_DEPENDENCIES, dependencies);
+	std::vector<std::string> node_names;
+	for (const tinygltf::Node& node : model.nodes) {
+		node_names.push_back(node.name);
+	}
+	write_strings(SC_NODE_NAMES, node_names);
+	write_vector(SC_VERTICES, scene.geometry.vertex_data());
+	write_vector(SC_INDICES, scene.geometry.staged_indices());
+	write_vector(SC_NARROW_INDICES, scene.geometry.staged_narrow_indices());
+
+	std::vector<PrimitiveRecord> primitives;
+	std::vector<GeometryLod> lods;
+	std::vector<Meshlet> meshlets;
+	for (const auto& prim : scene.primitives) {
+		primitives.push_back(PrimitiveRecord{
+			.mode = prim->mode,
+			.material = prim->material_index,
+			.first_lod = static_cast<uint32_t>(lods.size()),
+			.lod_count = static_cast<uint32_t>(prim->lods.size()),
+			.first_meshlet = static_cast<uint32_t>(meshlets.size()),
+			.meshlet_count = static_cast<uint32_t>(prim->meshlets.size()),
+			.bounds = prim->bounds,
+			.vertex_bounds = prim->vertex_bounds,
+		});
+		lods.insert(lods.end(), prim->lods.begin(), prim->lods.end());
+		meshlets.insert(meshlets.end(), prim->meshlets.begin(), prim->meshlets.end());
+	}
+	write_vector(SC_PRIMITIVES, primitives);
+	write_vector(SC_LODS, lods);
+	write_vector(SC_MESHLETS, meshlets);
+	std::vector<MeshRecord> meshes;
+	for (const auto& mesh : scene.meshes) {
+		uint32_t first = mesh->primitives.empty() ? 0 : mesh->primitives[0]->index;
+		meshes.push_back(MeshRecord{ first, static_cast<uint32_t>(mesh->primitives.size()) });
+	}
+	write_vector(SC_MESHES, meshes);
+
+	std::vector<GraphRecord> graph;
+	for (uint32_t i = 0; i < scene.graph.size(); ++i) {
+		graph.push_back(GraphRecord{ scene.graph.parent[i], scene.graph.subtree_end[i], scene.graph.node[i],
+			scene.graph.mesh[i], scene.graph.local[i] });
+	}
+	write_vector(SC_GRAPH, graph);
+	std::vector<InstanceRange> instance_ranges;
+	std::vector<glm::mat4> instances;
+	for (const auto& node : scene.node_instances) {
+		instance_ranges.push_back(InstanceRange{ static_cast<uint32_t>(instances.size()), static_cast<uint32_t>(node.size()) });
+		instances.insert(instances.end(), node.begin(), node.end());
+	}
+	write_vector(SC_INSTANCE_RANGES, instance_ranges);
+	write_vector(SC_INSTANCES, instances);
+
+	std::vector<MaterialRecord> materials;
+	for (const tinygltf::Material& material : model.materials) {
+		uint32_t alpha_mode = material.alphaMode == "BLEND" ? AM_BLEND : material.alphaMode == "MASK" ? AM_MASK : AM_OPAQUE;
+		materials.push_back(MaterialRecord{ material.pbrMetallicRoughness.baseColorTexture.index, alpha_mode,
+			material.doubleSided ? 1u : 0u });
+	}
+	write_vector(SC_MATERIALS, materials);
+	std::vector<TextureRecord> textures;
+	for (const tinygltf::Texture& texture : model.textures) {
+		tinygltf::Sampler sampler;
+		if (texture.sampler >= 0) {
+			sampler = model.samplers[texture.sampler];
+		}
+		textures.push_back(TextureRecord{ texture.source, sampler.wrapS, sampler.wrapT, sampler.minFilter, sampler.magFilter });
+	}
+	write_vector(SC_TEXTURES, textures);
+
+	// mip chains with a box filter, like glGenerateMipmap; only for 8 bit
+	// images, the rest get theirs generated at load
+	std::vector<ImageRecord> image_records;
+	std::vector<unsigned char> texels;
+	for (const tinygltf::Image& image : model.images) {
+		ImageRecord record{ static_cast<uint32_t>(std::max(image.width, 0)), static_cast<uint32_t>(std::max(image.height, 0)),
+			static_cast<uint32_t>(std::max(image.component, 0)), static_cast<uint32_t>(image.pixel_type), 0, 0, 0 };
+		texels.resize((texels.size() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT);
+		record.offset = texels.size();
+		if (!image.image.empty() && record.width * record.height > 0) {
+			texels.insert(texels.end(), image.image.begin(), image.image.end());
+			record.levels = 1;
+			uint32_t width = record.width, height = record.height, components = record.components;
+			while (image.bits == 8 && (width > 1 || height > 1)) {
+				const unsigned char* level = texels.data() + texels.size() - size_t(width) * height * components;
+				uint32_t next_width = std::max(1u, width / 2), next_height = std::max(1u, height / 2);
+				std::vector<unsigned char> next(size_t(next_width) * next_height * components);
+				for (uint32_t y = 0; y < next_height; ++y) {
+					for (uint32_t x = 0; x < next_width; ++x) {
+						uint32_t x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+						uint32_t y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+						for (uint32_t c = 0; c < components; ++c) {
+							uint32_t sum = level[(size_t(y0) * width + x0) * components + c] + level[(size_t(y0) * width + x1) * components + c]
+								+ level[(size_t(y1) * width + x0) * components + c] + level[(size_t(y1) * width + x1) * components + c];
+							next[(size_t(y) * next_width + x) * components + c] = static_cast<unsigned char>((sum + 2) / 4);
+						}
+					}
+				}
+				texels.insert(texels.end(), next.begin(), next.end());
+				width = next_width;
+				height = next_height;
+				record.levels += 1;
+			}
+		}
+		image_records.push_back(record);
+	}
+	write_vector(SC_IMAGES, image_records);
+	write_vector(SC_TEXELS, texels);
+
+	out.seekp(0);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(sections), sizeof(sections));
+	if (!out) {
+		err = "failed writing " + output;
+		return false;
+	}
+	return true;
+}
+
+std::vector<std::string> SceneCache::strings(SectionId id) const {
+	std::vector<std::string> result;
+	std::span<const char> chars = section<char>(id);
+	for (size_t i = 0; i < chars.size();) {
+		size_t length = strnlen(chars.data() + i, chars.size() - i);
+		result.emplace_back(chars.data() + i, length);
+		i += length + 1;
+	}
+	return result;
+}
+
+bool SceneCache::open(const std::string& path, const std::string& source, uint32_t flags, std::string& err) {
+	if (!file.open(path)) {
+		err = "no cache at " + path;
+		return false;
+	}
+	if (file.size() < sizeof(Header) + sizeof(sections)) {
+		err = path + " is truncated";
+		return false;
+	}
+	std::memcpy(&header, file.data(), sizeof(Header));
+	if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION || header.section_count != SC_COUNT) {
+		err = path + " is not a version " + std::to_string(VERSION) + " cache";
+		return false;
+	}
+	if (header.flags != flags) {
+		err = path + " was cooked with other geometry settings";
+		return false;
+	}
+	std::memcpy(sections, file.data() + sizeof(Header), sizeof(sections));
+	for (const Section& s : sections) {
+		if (s.offset % ALIGNMENT != 0 || s.offset > file.size() || s.size > file.size() - s.offset) {
+			err = path + " has a section out of bounds";
+			return false;
+		}
+	}
+	if (!validate_records(err)) {
+		err = path + " " + err;
+		return false;
+	}
+	uint64_t hash = hash_sources(source, strings(SC_DEPENDENCIES), err);
+	if (!err.empty()) {
+		return false;
+	}
+	if (hash != header.source_hash) {
+		err = path + " is stale, " + source + " changed since it was cooked";
+		return false;
+	}
+	return true;
+}
+
+bool SceneCache::validate_records(std::string& err) const {
+	auto in_range = [](uint64_t first, uint64_t count, uint64_t size) {
+		return first <= size && count <= size - first;
+	};
+	auto fail = [&](const char* what, size_t i) {
+		err = std::string("has ") + what + " " + std::to_string(i) + " out of range";
+		return false;
+	};
+	size_t vertex_size = header.flags & SCF_QUANTIZE ? sizeof(GeometryPool::QuantizedVertex) : sizeof(GeometryPool::Vertex);
+	uint64_t vertex_count = sections[SC_VERTICES].size / vertex_size;
+	uint64_t index_count = section<uint32_t>(SC_INDICES).size();
+	uint64_t narrow_index_count = section<uint16_t>(SC_NARROW_INDICES).size();
+	// indices of a range, in the buffer its index type draws from
+	auto indices_of = [&](const GeometryRange& range) {
+		return range.index_type == GL_UNSIGNED_SHORT ? narrow_index_count : range.index_type == GL_UNSIGNED_INT ? index_count : 0;
+	};
+
+	std::span<const GeometryLod> lods = section<GeometryLod>(SC_LODS);
+	for (size_t i = 0; i < lods.size(); ++i) {
+		const GeometryRange& range = lods[i].range;
+		if (range.base_vertex < 0 || !in_range(static_cast<uint64_t>(range.base_vertex), range.vertex_count, vertex_count)
+			|| !in_range(range.first_index, range.index_count, indices_of(range))) {
+			return fail("LOD", i);
+		}
+	}
+	std::span<const Meshlet> meshlets = section<Meshlet>(SC_MESHLETS);
+	size_t material_count = section<MaterialRecord>(SC_MATERIALS).size();
+	std::span<const PrimitiveRecord> primitives = section<PrimitiveRecord>(SC_PRIMITIVES);
+	for (size_t i = 0; i < primitives.size(); ++i) {
+		const PrimitiveRecord& record = primitives[i];
+		if (record.lod_count == 0 || !in_range(record.first_lod, record.lod_count, lods.size())
+			|| !in_range(record.first_meshlet, record.meshlet_count, meshlets.size()) || record.material >= material_count) {
+			return fail("primitive", i);
+		}
+		// meshlets are drawn from the index buffer of the first LOD
+		uint64_t meshlet_indices = indices_of(lods[record.first_lod].range);
+		for (uint32_t m = record.first_meshlet; m < record.first_meshlet + record.meshlet_count; ++m) {
+			if (!in_range(meshlets[m].first_index, meshlets[m].index_count, meshlet_indices)) {
+				return fail("meshlet", m);
+			}
+		}
+	}
+	std::span<const MeshRecord> meshes = section<MeshRecord>(SC_MESHES);
+	for (size_t i = 0; i < meshes.size(); ++i) {
+		if (!in_range(meshes[i].first_primitive, meshes[i].primitive_count, primitives.size())) {
+			return fail("mesh", i);
+		}
+	}
+
+	std::span<const glm::mat4> instances = section<glm::mat4>(SC_INSTANCES);
+	std::span<const InstanceRange> instance_ranges = section<InstanceRange>(SC_INSTANCE_RANGES);
+	for (size_t i = 0; i < instance_ranges.size(); ++i) {
+		if (!in_range(instance_ranges[i].first, instance_ranges[i].count, instances.size())) {
+			return fail("instance range", i);
+		}
+	}
+	// graph nodes index both the node names and the instance ranges, one per glTF node
+	size_t node_count = std::min(strings(SC_NODE_NAMES).size(), instance_ranges.size());
+	std::span<const GraphRecord> graph = section<GraphRecord>(SC_GRAPH);
+	for (size_t i = 0; i < graph.size(); ++i) {
+		const GraphRecord& record = graph[i];
+		// flat order: parents come first and subtrees are contiguous
+		bool parent_ok = record.parent == SceneGraph::NO_PARENT || (record.parent >= 0 && static_cast<size_t>(record.parent) < i);
+		bool subtree_ok = record.subtree_end > i && record.subtree_end <= graph.size();
+		bool node_ok = record.node >= 0 && static_cast<size_t>(record.node) < node_count;
+		bool mesh_ok = record.mesh == -1 || (record.mesh >= 0 && static_cast<size_t>(record.mesh) < meshes.size());
+		if (!parent_ok || !subtree_ok || !node_ok || !mesh_ok) {
+			return fail("graph node", i);
+		}
+	}
+
+	std::span<const ImageRecord> images = section<ImageRecord>(SC_IMAGES);
+	uint64_t texel_bytes = sections[SC_TEXELS].size;
+	for (size_t i = 0; i < images.size(); ++i) {
+		const ImageRecord& image = images[i];
+		if (image.levels == 0) {
+			continue;
+		}
+		if (image.components < 1 || image.components > 4 || (image.pixel_type != GL_UNSIGNED_BYTE && image.pixel_type != GL_UNSIGNED_SHORT)
+			|| image.width == 0 || image.height == 0 || image.levels > 32) {
+			return fail("image", i);
+		}
+		uint64_t texel_size = image.components * (image.pixel_type == GL_UNSIGNED_BYTE ? 1 : 2);
+		uint64_t bytes = 0;
+		uint64_t width = image.width, height = image.height;
+		for (uint32_t l = 0; l < image.levels; ++l) {
+			bytes += width * height * texel_size;
+			width = std::max<uint64_t>(1, width / 2);
+			height = std::max<uint64_t>(1, height / 2);
+		}
+		if (!in_range(image.offset, bytes, texel_bytes)) {
+			return fail("image", i);
+		}
+	}
+	std::span<const TextureRecord> textures = section<TextureRecord>(SC_TEXTURES);
+	for (size_t i = 0; i < textures.size(); ++i) {
+		if (textures[i].image < -1 || textures[i].image >= static_cast<int64_t>(images.size())) {
+			return fail("texture", i);
+		}
+	}
+	// init_materials() looks the texture of every material up unchecked
+	std::span<const MaterialRecord> materials = section<MaterialRecord>(SC_MATERIALS);
+	for (size_t i = 0; i < materials.size(); ++i) {
+		if (materials[i].texture < 0 || static_cast<size_t>(materials[i].texture) >= textures.size()) {
+			return fail("material", i);
+		}
+	}
+	return true;
+}
+
+void SceneCache::restore(GLTFScene& scene) const {
+	tinygltf::Model& model = scene.model;
+	model.defaultScene = header.default_scene;
+	std::vector<std::string> node_names = strings(SC_NODE_NAMES);
+	model.nodes.resize(node_names.size());
+	for (size_t i = 0; i < node_names.size(); ++i) {
+		model.nodes[i].name = std::move(node_names[i]);
+	}
+	static const char* alpha_modes[] = { "OPAQUE", "MASK", "BLEND" };
+	for (const MaterialRecord& record : section<MaterialRecord>(SC_MATERIALS)) {
+		tinygltf::Material& material = model.materials.emplace_back();
+		material.alphaMode = alpha_modes[std::min<uint32_t>(record.alpha_mode, AM_BLEND)];
+		material.pbrMetallicRoughness.baseColorTexture.index = record.texture;
+		material.doubleSided = record.double_sided != 0;
+	}
+	// one sampler per texture, as init_materials() reads them
+	for (const TextureRecord& record : section<TextureRecord>(SC_TEXTURES)) {
+		tinygltf::Texture& texture = model.textures.emplace_back();
+		texture.source = record.image;
+		texture.sampler = static_cast<int>(model.samplers.size());
+		tinygltf::Sampler& sampler = model.samplers.emplace_back();
+		sampler.wrapS = record.wrap_s;
+		sampler.wrapT = record.wrap_t;
+		sampler.minFilter = record.min_filter;
+		sampler.magFilter = record.mag_filter;
+	}
+	for (const ImageRecord& record : section<ImageRecord>(SC_IMAGES)) {
+		tinygltf::Image& image = model.images.emplace_back();
+		image.width = static_cast<int>(record.width);
+		image.height = static_cast<int>(record.height);
+		image.component = static_cast<int>(record.components);
+		image.pixel_type = static_cast<int>(record.pixel_type);
+	}
+
+	scene.geometry.optimize = header.flags & SCF_OPTIMIZE;
+	scene.geometry.quantize = header.flags & SCF_QUANTIZE;
+	std::span<const GeometryLod> lods = section<GeometryLod>(SC_LODS);
+	std::span<const Meshlet> meshlets = section<Meshlet>(SC_MESHLETS);
+	for (const PrimitiveRecord& record : section<PrimitiveRecord>(SC_PRIMITIVES)) {
+		auto prim = std::make_shared<GLTFPrimitive>();
+		prim->index = static_cast<uint32_t>(scene.primitives.size());
+		prim->mode = record.mode;
+		prim->material_index = record.material;
+		prim->lods.assign(lods.begin() + record.first_lod, lods.begin() + record.first_lod + record.lod_count);
+		prim->meshlets.assign(meshlets.begin() + record.first_meshlet, meshlets.begin() + record.first_meshlet + record.meshlet_count);
+		prim->bounds = record.bounds;
+		prim->vertex_bounds = record.vertex_bounds;
+		prim->dequantization = prim->lods[0].range.dequantization();
+		scene.primitives.push_back(prim);
+	}
+	for (const MeshRecord& record : section<MeshRecord>(SC_MESHES)) {
+		auto mesh = std::make_shared<GLTFMesh>();
+		mesh->primitives.assign(scene.primitives.begin() + record.first_primitive,
+			scene.primitives.begin() + record.first_primitive + record.primitive_count);
+		scene.meshes.push_back(mesh);
+	}
+
+	std::span<const glm::mat4> instances = section<glm::mat4>(SC_INSTANCES);
+	for (const InstanceRange& range : section<InstanceRange>(SC_INSTANCE_RANGES)) {
+		scene.node_instances.emplace_back(instances.begin() + range.first, instances.begin() + range.first + range.count);
+	}
+	std::span<const GraphRecord> graph = section<GraphRecord>(SC_GRAPH);
+	std::vector<int32_t> parents(graph.size()), nodes(graph.size()), meshes(graph.size());
+	std::vector<uint32_t> subtree_ends(graph.size());
+	std::vector<glm::mat4> locals(graph.size());
+	for (size_t i = 0; i < graph.size(); ++i) {
+		parents[i] = graph[i].parent;
+		subtree_ends[i] = graph[i].subtree_end;
+		nodes[i] = graph[i].node;
+		meshes[i] = graph[i].mesh;
+		locals[i] = graph[i].local;
+	}
+	scene.graph.build(std::move(parents), std::move(subtree_ends), std::move(nodes), std::move(meshes), std::move(locals));
+	scene.create_items();
+}
+
+void SceneCache::upload(GLTFScene& scene, std::shared_ptr<ShaderProgram> shader_program, std::shared_ptr<PointLight> light,
+	std::shared_ptr<Texture> shadow_map) {
+	scene.init_materials(shader_program, light, shadow_map, true);
+	std::span<const ImageRecord> images = section<ImageRecord>(SC_IMAGES);
+	std::span<const unsigned char> texels = section<unsigned char>(SC_TEXELS);
+	static const GLenum formats[] = { GL_RGBA, GL_RED, GL_RG, GL_RGB, GL_RGBA };
+	for (size_t t = 0; t < scene.textures.size(); ++t) {
+		int source = scene.model.textures[t].source;
+		if (source < 0 || static_cast<size_t>(source) >= images.size() || images[source].levels == 0) {
+			continue;
+		}
+		const ImageRecord& image = images[source];
+		GLenum format = formats[std::min<uint32_t>(image.components, 4)];
+		size_t texel_size = image.components * (image.pixel_type == GL_UNSIGNED_BYTE ? 1 : 2);
+		const unsigned char* level = texels.data() + image.offset;
+		uint32_t width = image.width, height = image.height;
+		for (uint32_t l = 0; l < image.levels; ++l) {
+			scene.textures[t]->set_level(static_cast<int>(l), static_cast<int>(width), static_cast<int>(height), level, image.pixel_type, format);
+			level += size_t(width) * height * texel_size;
+			width = std::max(1u, width / 2);
+			height = std::max(1u, height / 2);
+		}
+		if (image.levels == 1) {
+			glGenerateMipmap(GL_TEXTURE_2D);
+		}
+	}
+
+	std::span<const unsigned char> vertices = section<unsigned char>(SC_VERTICES);
+	std::span<const uint32_t> indices = section<uint32_t>(SC_INDICES);
+	std::span<const uint16_t> narrow_indices = section<uint16_t>(SC_NARROW_INDICES);
+	size_t vertex_size = scene.geometry.quantize ? sizeof(GeometryPool::QuantizedVertex) : sizeof(GeometryPool::Vertex);
+	scene.geometry.upload(vertices.data(), vertices.size() / vertex_size, indices.data(), indices.size(),
+		narrow_indices.data(), narrow_indices.size());
+	scene.upload_meshlets();
+	file.close();
+}
+
+// Times what a start pays on the CPU before GL takes over: parsing, decoding
+// and geometry processing for the glTF against mapping, checking and
+// restoring its cache. The cache is cooked into the temp directory first.
+// GL uploads are left out of both; the glTF path additionally pays for
+// glGenerateMipmap there.
+inline void benchmark_scene_cache(const std::vector<std::string>& filenames, uint32_t flags, std::ostream& os) {
+	using clock = std::chrono::high_resolution_clock;
+	auto ms_since = [](clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+	};
+	for (const std::string& filename : filenames) {
+		std::string cache_path = (std::filesystem::temp_directory_path() / std::filesystem::path(SceneCache::path_for(filename)).filename()).string();
+		std::string err;
+		auto start = clock::now();
+		if (!SceneCache::cook(filename, cache_path, flags, err)) {
+			os << filename << ": " << err << std::endl;
+			continue;
+		}
+		double cook_ms = ms_since(start);
+
+		start = clock::now();
+		{
+			GLTFScene scene;
+			scene.optimize_geometry = flags & SceneCache::SCF_OPTIMIZE;
+			scene.quantize_vertices = flags & SceneCache::SCF_QUANTIZE;
+			scene.generate_lods = flags & SceneCache::SCF_LODS;
+			scene.generate_meshlets = flags & SceneCache::SCF_MESHLETS;
+			DeferredImageLoader images;
+			scene.parse(filename, images);
+			images.decode(scene.model, scene.err);
+			scene.build_geometry();
+			scene.graph.build(scene.model, std::max(scene.model.defaultScene, 0));
+		}
+		double gltf_ms = ms_since(start);
+
+		start = clock::now();
+		double open_ms = .0;
+		{
+			SceneCache cache;
+			GLTFScene scene;
+			if (!cache.open(cache_path, filename, flags, err)) {
+				os << filename << ": " << err << std::endl;
+				continue;
+			}
+			open_ms = ms_since(start);
+			cache.restore(scene);
+		}
+		double cache_ms = ms_since(start);
+		os << filename << ": glTF " << gltf_ms << " ms, cache " << cache_ms << " ms (" << open_ms
+			<< " ms of it checking sources), " << std::filesystem::file_size(cache_path) / 1024 << " KiB cooked in "
+			<< cook_ms << " ms" << std::endl;
+	}
+}
@@ -0,0 +1,168 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "glm/ext/matrix_transform.hpp"
+
+#include "utils.hpp"
+
+// local matrix of a glTF node, from its matrix or its TRS properties
+inline glm::mat4 node_local_matrix(const tinygltf::Node& node) {
+	glm::mat4 matrix(1.0f);
+
+	if (node.matrix.size() == 16) {
+		matrix = glm::make_mat4(node.matrix.data());
+	} else {
+		if (node.scale.size() == 3) {
+			glm::mat4 scale = glm::scale(glm::mat4(1.0), glm::vec3(node.scale[0], node.scale[1], node.scale[2]));
+			matrix = scale * matrix;
+		}
+		if (node.rotation.size() == 4) {
+			glm::quat qua(node.rotation[3], node.rotation[0], node.rotation[1], node.rotation[2]);
+			glm::mat4 rotate = glm::mat4_cast(qua);
+			matrix = rotate * matrix;
+		}
+		if (node.translation.size() == 3) {
+			glm::mat4 translate = glm::translate(glm::mat4(1.0), glm::vec3(node.translation[0], node.translation[1], node.translation[2]));
+			matrix = translate * matrix;
+		}
+	}
+	return matrix;
+}
+
+// Node hierarchy of one glTF scene flattened in depth-first preorder: every
+// parent comes before its children and a subtree is the contiguous range
+// [i, subtree_end[i]). World matrices are cached and only recomputed below
+// nodes marked dirty, so a static scene costs nothing per frame.
+struct SceneGraph {
+	static constexpr int32_t NO_PARENT = -1;
+
+	// per flat node
+	std::vector<int32_t> parent;
+	std::vector<uint32_t> subtree_end;
+	std::vector<int32_t> node;  // index into tinygltf::Model::nodes
+	std::vector<int32_t> mesh;
+	std::vector<glm::mat4> local;
+	std::vector<glm::mat4> world;
+	std::vector<uint8_t> dirty;
+	// set for the nodes whose world matrix the last update() recomputed
+	std::vector<uint8_t> changed;
+
+	// flat nodes with a mesh, in flat order
+	std::vector<uint32_t> drawables;
+
+	// world matrices recomputed by the last update()
+	size_t last_updated = 0;
+
+	void build(const tinygltf::Model& model, int scene_index);
+	// from the per flat node arrays of an earlier build(), e.g. a SceneCache
+	void build(std::vector<int32_t> parents, std::vector<uint32_t> subtree_ends, std::vector<int32_t> nodes,
+		std::vector<int32_t> meshes, std::vector<glm::mat4> locals);
+	size_t size() const {
+		return parent.size();
+	}
+
+	void set_local(uint32_t i, const glm::mat4& matrix);
+	// transform applied above the scene's root nodes
+	void set_root_transform(const glm::mat4& matrix);
+	void update();
+
+private:
+	void add(const tinygltf::Model& model, int gltf_node, int32_t parent_index);
+	// derives drawables and the caches from the flat node arrays
+	void finish_build();
+
+	glm::mat4 root_transform = glm::mat4(1.0f);
+	bool any_dirty = false;
+};
+
+void SceneGraph::build(const tinygltf::Model& model, int scene_index) {
+	*this = SceneGraph{};
+	if (scene_index < 0 || scene_index >= static_cast<int>(model.scenes.size())) {
+		return;
+	}
+	for (int root : model.scenes[scene_index].nodes) {
+		add(model, root, NO_PARENT);
+	}
+	finish_build();
+}
+
+void SceneGraph::build(std::vector<int32_t> parents, std::vector<uint32_t> subtree_ends, std::vector<int32_t> nodes,
+	std::vector<int32_t> meshes, std::vector<glm::mat4> locals) {
+	*this = SceneGraph{};
+	parent = std::move(parents);
+	subtree_end = std::move(subtree_ends);
+	node = std::move(nodes);
+	mesh = std::move(meshes);
+	local = std::move(locals);
+	finish_build();
+}
+
+void SceneGraph::finish_build() {
+	for (uint32_t i = 0; i < size(); ++i) {
+		if (mesh[i] != -1) {
+			drawables.push_back(i);
+		}
+	}
+	world.resize(size());
+	dirty.assign(size(), 1);
+	changed.assign(size(), 0);
+	any_dirty = true;
+}
+
+void SceneGraph::add(const tinygltf::Model& model, int gltf_node, int32_t parent_index) {
+	const tinygltf::Node& n = model.nodes[gltf_node];
+	uint32_t index = static_cast<uint32_t>(size());
+	parent.push_back(parent_index);
+	subtree_end.push_back(0);
+	node.push_back(gltf_node);
+	mesh.push_back(n.mesh);
+	local.push_back(node_local_matrix(n));
+	for (int child : n.children) {
+		add(model, child, static_cast<int32_t>(index));
+	}
+	subtree_end[index] = static_cast<uint32_t>(size());
+}
+
+void SceneGraph::set_local(uint32_t i, const glm::mat4& matrix) {
+	local[i] = matrix;
+	dirty[i] = 1;
+	any_dirty = true;
+}
+
+void SceneGraph::set_root_transform(const glm::mat4& matrix) {
+	root_transform = matrix;
+	for (uint32_t i = 0; i < size(); i = subtree_end[i]) {
+		dirty[i] = 1;
+	}
+	any_dirty = true;
+}
+
+// parents precede children, so one linear pass sees every parent's world
+// matrix updated before its children need it
+void SceneGraph::update() {
+	if (last_updated > 0) {
+		std::fill(changed.begin(), changed.end(), 0);
+		last_updated = 0;
+	}
+	if (!any_dirty) {
+		return;
+	}
+	uint32_t dirty_end = 0;
+	for (uint32_t i = 0; i < size(); ++i) {
+		if (!dirty[i] && i >= dirty_end) {
+			continue;
+		}
+		if (dirty[i]) {
+			dirty_end = std::max(dirty_end, subtree_end[i]);
+			dirty[i] = 0;
+		}
+		world[i] = (parent[i] == NO_PARENT ? root_transform : world[parent[i]]) * local[i];
+		changed[i] = 1;
+		last_updated += 1;
+	}
+	any_dirty = false;
+}
@@ -0,0 +1,286 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "gltf_scene.hpp"
+#include "image_loader.hpp"
+
+// Loads a GLTFScene behind the render loop instead of before it. A loader
+// thread parses the file and builds the geometry while a decode thread
+// decodes the images, one at a time. poll() does the GL side between frames:
+// the materials with placeholder textures once the file is parsed, the
+// geometry in parts once built, and decoded images copied into their
+// textures through a pixel buffer, stopping after budget_ms each frame.
+// Neither thread uses the ThreadPool, which belongs to the frame.
+struct SceneStreamer {
+	using clock = std::chrono::high_resolution_clock;
+
+	// rows copied into the pixel buffer between checks of the budget
+	static constexpr int UPLOAD_ROWS = 64;
+	// bytes of vertices and indices sent between checks of the budget
+	static constexpr size_t GEOMETRY_PART_BYTES = 256 * 1024;
+
+	SceneStreamer(std::shared_ptr<GLTFScene> scene, const std::string& filename);
+	~SceneStreamer();
+
+	// call once per frame on the render thread; true once the scene has
+	// geometry to draw
+	bool poll(std::shared_ptr<ShaderProgram> shader_program, std::shared_ptr<PointLight> light,
+		std::shared_ptr<Texture> shadow_map, double budget_ms);
+	// call after the first frame is presented
+	void first_frame();
+	bool drawable() const {
+		return geometry_uploaded;
+	}
+	bool done() const {
+		return finished;
+	}
+	void print_stats(std::ostream& os) const;
+
+private:
+	void load(const std::string& filename);
+	void decode();
+	// copies rows of the image being uploaded, or starts the next decoded
+	// one, until budget_ms is used up; worked if the poll did something
+	// already. False once nothing is left to do.
+	bool upload_images(clock::time_point poll_start, double budget_ms, bool worked);
+	// gives the textures of an image copied into the pixel buffer their level
+	// 0 and mips, if the rest of the budget fits the slowest one so far
+	bool finish_image(const tinygltf::Image& image, double remaining_ms, bool worked);
+	double ms_since_start(clock::time_point t = clock::now()) const {
+		return std::chrono::duration<double, std::milli>(t - start).count();
+	}
+	static double ms_since(clock::time_point t) {
+		return std::chrono::duration<double, std::milli>(clock::now() - t).count();
+	}
+
+	std::shared_ptr<GLTFScene> scene;
+	DeferredImageLoader images;
+	std::thread loader, decoder;
+	clock::time_point start;
+
+	std::atomic<bool> parsed{ false }, parse_failed{ false }, geometry_built{ false };
+	std::mutex mutex;
+	std::deque<size_t> decoded;  // into images.pending, guarded by mutex
+	std::vector<std::string> decode_errors;
+
+	bool materials_created = false;
+	bool geometry_uploaded = false;
+	bool finished = false;
+	// per image, the textures that show it
+	std::vector<std::vector<size_t>> image_textures;
+	GLuint pixel_buffer = 0;
+	// image being copied into pixel_buffer, or -1
+	int64_t uploading = -1;
+	int uploaded_rows = 0;
+	size_t uploaded_images = 0;
+	size_t uploaded_bytes = 0;
+	size_t upload_frames = 0;
+	// texture creation and mip generation per MiB of image, the slowest seen
+	double finish_ms_per_mib = .0;
+
+	double first_frame_ms = -1.0, drawable_ms = -1.0, finished_ms = -1.0;
+	double longest_poll_ms = .0, budget_ms = .0;
+	size_t polls = 0, polls_over_budget = 0;
+};
+
+SceneStreamer::SceneStreamer(std::shared_ptr<GLTFScene> scene, const std::string& filename)
+	: scene(scene), start(clock::now()) {
+	loader = std::thread([this, filename] { load(filename); });
+}
+
+SceneStreamer::~SceneStreamer() {
+	if (loader.joinable()) {
+		loader.join();
+	}
+	// started by the loader, so only read once it has been joined
+	if (decoder.joinable()) {
+		decoder.join();
+	}
+	if (pixel_buffer != 0) {
+		glDeleteBuffers(1, &pixel_buffer);
+	}
+}
+
+void SceneStreamer::load(const std::string& filename) {
+	bool result = scene->parse(filename, images);
+	std::cout << "streaming " << filename << ": parsed in " << ms_since_start() << " ms" << std::endl;
+	if (!result) {
+		parse_failed = true;
+		parsed = true;
+		return;
+	}
+	decode_errors.resize(images.pending.size());
+	parsed = true;
+	decoder = std::thread([this] { decode(); });
+	scene->build_geometry();
+	// quantizing the vertices is CPU work, so the render thread only copies
+	scene->geometry.stage_upload();
+	std::cout << "streaming: geometry built in " << ms_since_start() << " ms" << std::endl;
+	geometry_built = true;
+}
+
+void SceneStreamer::decode() {
+	for (size_t i = 0; i < images.pending.size(); ++i) {
+		images.decode(scene->model, i, decode_errors[i]);
+		images.pending[i].release();
+		std::lock_guard<std::mutex> lock(mutex);
+		decoded.push_back(i);
+	}
+}
+
+bool SceneStreamer::poll(std::shared_ptr<ShaderProgram> shader_program, std::shared_ptr<PointLight> light,
+	std::shared_ptr<Texture> shadow_map, double budget_ms) {
+	if (finished) {
+		return geometry_uploaded;
+	}
+	auto poll_start = clock::now();
+	bool worked = false;
+	if (!materials_created && parsed) {
+		if (parse_failed) {
+			finished = true;
+			return false;
+		}
+		scene->init_materials(shader_program, light, shadow_map, true);
+		image_textures.resize(scene->model.images.size());
+		for (size_t t = 0; t < scene->model.textures.size(); ++t) {
+			// textures without a source keep their placeholder
+			int source = scene->model.textures[t].source;
+			if (source >= 0 && static_cast<size_t>(source) < image_textures.size()) {
+				image_textures[source].push_back(t);
+			}
+		}
+		materials_created = true;
+		worked = true;
+	}
+	while (materials_created && !geometry_uploaded && geometry_built && ms_since(poll_start) < budget_ms) {
+		if (scene->upload_geometry_part(GEOMETRY_PART_BYTES)) {
+			geometry_uploaded = true;
+			drawable_ms = ms_since_start();
+		}
+		worked = true;
+	}
+	bool uploading_images = materials_created && upload_images(poll_start, budget_ms, worked);
+
+	if (geometry_uploaded && !uploading_images && uploaded_images == images.pending.size()) {
+		loader.join();
+		decoder.join();
+		for (const std::string& error : decode_errors) {
+			if (!error.empty()) {
+				std::cerr << error << std::endl;
+			}
+		}
+		if (scene->release_payloads) {
+			scene->release_model_payloads();
+		}
+		finished = true;
+		finished_ms = ms_since_start();
+	}
+	double poll_ms = ms_since(poll_start);
+	longest_poll_ms = std::max(longest_poll_ms, poll_ms);
+	this->budget_ms = budget_ms;
+	polls += 1;
+	polls_over_budget += poll_ms > budget_ms;
+	return geometry_uploaded;
+}
+
+bool SceneStreamer::upload_images(clock::time_point poll_start, double budget_ms, bool worked) {
+	auto* gl_state = GLState::getInstance();
+	bool copied = false;
+	while (ms_since(poll_start) < budget_ms) {
+		if (uploading < 0) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (decoded.empty()) {
+				break;
+			}
+			uploading = static_cast<int64_t>(images.pending[decoded.front()].image);
+			decoded.pop_front();
+			uploaded_rows = 0;
+		}
+		tinygltf::Image& image = scene->model.images[uploading];
+		// failed to decode, its textures keep the placeholder
+		if (image.image.empty() || image.height <= 0) {
+			uploaded_images += 1;
+			uploading = -1;
+			continue;
+		}
+		if (uploaded_rows >= image.height) {
+			// copied by an earlier poll or iteration, the budget was checked since
+			if (!finish_image(image, budget_ms - ms_since(poll_start), worked || copied)) {
+				break;
+			}
+			copied = true;
+			continue;
+		}
+		if (pixel_buffer == 0) {
+			glGenBuffers(1, &pixel_buffer);
+		}
+		size_t row_bytes = image.image.size() / image.height;
+		gl_state->bind_buffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+		if (uploaded_rows == 0) {
+			// orphaned, so the rows can be written without waiting for the
+			// texture copy of the last image
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, image.image.size(), nullptr, GL_STREAM_DRAW);
+		}
+		int rows = std::min(UPLOAD_ROWS, image.height - uploaded_rows);
+		size_t offset = static_cast<size_t>(uploaded_rows) * row_bytes;
+		void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, rows * row_bytes,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (dst != nullptr) {
+			std::memcpy(dst, image.image.data() + offset, rows * row_bytes);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+		uploaded_rows += rows;
+		copied = true;
+		gl_state->bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	upload_frames += copied;
+	return uploading >= 0;
+}
+
+bool SceneStreamer::finish_image(const tinygltf::Image& image, double remaining_ms, bool worked) {
+	size_t bytes = image.image.size();
+	// a poll that did nothing else finishes it regardless, or a texture
+	// slower than the whole budget would never be
+	if (worked && finish_ms_per_mib * bytes / (1 << 20) > remaining_ms) {
+		return false;
+	}
+	auto finish_start = clock::now();
+	auto* gl_state = GLState::getInstance();
+	gl_state->bind_buffer(GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+	for (size_t t : image_textures[uploading]) {
+		scene->textures[t]->set_image(image.width, image.height, nullptr, image.pixel_type);
+	}
+	gl_state->bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	finish_ms_per_mib = std::max(finish_ms_per_mib, ms_since(finish_start) * (1 << 20) / std::max<size_t>(bytes, 1));
+	uploaded_bytes += bytes;
+	if (scene->release_payloads) {
+		std::vector<unsigned char>().swap(scene->model.images[uploading].image);
+	}
+	uploaded_images += 1;
+	uploading = -1;
+	return true;
+}
+
+void SceneStreamer::first_frame() {
+	if (first_frame_ms < .0) {
+		first_frame_ms = ms_since_start();
+	}
+}
+
+void SceneStreamer::print_stats(std::ostream& os) const {
+	os << "streaming: first frame " << first_frame_ms << " ms, geometry drawn from " << drawable_ms << " ms, fully loaded "
+		<< finished_ms << " ms; " << uploaded_images << " images, " << uploaded_bytes / 1024 << " KiB uploaded over "
+		<< upload_frames << " frames; longest poll " << longest_poll_ms << " ms against a budget of " << budget_ms
+		<< " ms, " << polls_over_budget << " of " << polls << " polls over it" << std::endl;
+}
@@ -34,15 +34,31 @@ in vec2 texCoord;
 in vec3 normal;
 in vec3 pos_light_space;
 
-uniform sampler2D ourTexture;
-uniform sampler2D shadowMap;
-uniform PointLight light;
-uniform Material material;
-uniform vec3 eye;
-uniform float zNear;
-uniform float zFar;
-uniform float lightSize;
-uniform int recvShadow;
+layout (std140, binding = 0) uniform PassData {
+    mat4 view;
+    mat4 project;
+    mat4 vp_light;
+    vec4 eye;
+    vec4 light_position;
+    vec4 light_color; // a = intensity
+    float zNear;
+    float zFar;
+    float lightSize;
+};
+
+struct MaterialData {
+    float k_ambient, k_diffuse, k_specular;
+    float phong_exponent;
+    int recv_shadow;
+};
+
+layout (std140, binding = 1) uniform MaterialTable {
+    MaterialData materials[256];
+};
+
+layout (binding = 0) uniform sampler2D ourTexture;
+layout (binding = 1) uniform sampler2D shadowMap;
+uniform int materialIndex;
 
 float realDepth(float depth) {
     return 1 / (depth * (1/zFar - 1/zNear) + 1/zNear);
@@ -90,6 +106,9 @@ float shadowCalc(vec3 p_light_space, float bias) {
 void main()
 {
     vec4 color = texture(ourTexture, texCoord);
+    PointLight light = PointLight(light_position.xyz, light_color.rgb, light_color.a);
+    MaterialData m = materials[materialIndex];
+    Material material = Material(m.k_ambient, m.k_diffuse, m.k_specular, m.phong_exponent);
     vec3 light_dire = normalize(light.position - pos);
 
     // if (abs(dot(normalize(normal), light_dire)) < 0.01) {
@@ -101,10 +120,10 @@ void main()
     // }
     float shadow = 0.0f;
     float bias = 0.0005f;  
-    if (recvShadow != 0) {
+    if (m.recv_shadow != 0) {
         shadow = shadowCalc(pos_light_space, bias);
     }
-    vec3 phong_color = blinnPhong(material, light, normalize(normal), pos, eye, color.rgb, shadow);
+    vec3 phong_color = blinnPhong(material, light, normalize(normal), pos, eye.xyz, color.rgb, shadow);
     FragColor = vec4((1.5 - shadow) * color.rgb, color.w);
     // FragColor = vec4(phong_color, 1.0);
     // FragColor = vec4((normal + 1)/2, 1.0);
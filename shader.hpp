@@ -2,7 +2,15 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <unordered_map>
 #include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "gl_state.hpp"
 
 class Shader {
 public:
@@ -60,6 +68,17 @@ private:
 	}
 };
 
+// pre-resolved uniform of a ShaderProgram, see ShaderProgram::uniform
+template<typename T>
+struct Uniform {
+	GLint location = -1;
+	int slot = -1;
+
+	bool valid() const {
+		return slot >= 0;
+	}
+};
+
 class ShaderProgram {
 public:
 	GLuint handle;
@@ -75,10 +94,153 @@ public:
 			char info_log[1024];
 			glGetProgramInfoLog(handle, 1024, NULL, info_log);
 			std::cerr << info_log << std::endl;
+			return;
 		}
+		reflect_uniforms();
+	}
+
+	explicit ShaderProgram(const Shader& comp) {
+		handle = glCreateProgram();
+		glAttachShader(handle, comp.handle);
+		glLinkProgram(handle);
+		glGetProgramiv(handle, GL_LINK_STATUS, &success);
+		if (!success) {
+			char info_log[1024];
+			glGetProgramInfoLog(handle, 1024, NULL, info_log);
+			std::cerr << info_log << std::endl;
+			return;
+		}
+		reflect_uniforms();
 	}
 
 	void use() {
-		glUseProgram(handle);
+		GLState::getInstance()->use_program(handle);
+	}
+
+	// Looks up an active uniform once; a uniform the linker dropped yields an
+	// invalid handle, which set() ignores.
+	template<typename T>
+	Uniform<T> uniform(const std::string& name) const {
+		auto it = uniform_slots.find(name);
+		if (it == uniform_slots.end()) {
+			return Uniform<T>{};
+		}
+		const UniformSlot& slot = slots[it->second];
+		if (!UniformTraits<T>::accepts(slot.type)) {
+			std::cerr << "uniform " << name << " has GL type " << slot.type << ", which does not match the handle type" << std::endl;
+			return Uniform<T>{};
+		}
+		return Uniform<T>{ slot.location, it->second };
+	}
+
+	// Uploads the value unless this program already holds it.
+	template<typename T>
+	void set(const Uniform<T>& uniform, const T& value) {
+		if (!uniform.valid()) {
+			return;
+		}
+		UniformSlot& slot = slots[uniform.slot];
+		unsigned char* cached = value_cache.data() + slot.offset;
+		if (slot.initialized && std::memcmp(cached, &value, sizeof(T)) == 0) {
+			uniform_skips += 1;
+			return;
+		}
+		std::memcpy(cached, &value, sizeof(T));
+		slot.initialized = true;
+		uniform_uploads += 1;
+		UniformTraits<T>::upload(handle, uniform.location, value);
+	}
+
+	static void print_stats(std::ostream& os) {
+		os << "uniforms: " << uniform_uploads << " uploaded, " << uniform_skips << " unchanged and skipped" << std::endl;
+	}
+
+	static inline uint64_t uniform_uploads = 0, uniform_skips = 0;
+
+private:
+	struct UniformSlot {
+		GLint location;
+		GLenum type;
+		size_t offset;
+		bool initialized = false;
+	};
+
+	template<typename T> struct UniformTraits;
+
+	void reflect_uniforms() {
+		GLint count = 0, max_length = 0;
+		glGetProgramiv(handle, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(handle, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+		std::string name(std::max(max_length, 1), '\0');
+		size_t cache_size = 0;
+		for (GLint i = 0; i < count; ++i) {
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(handle, i, max_length, &length, &size, &type, name.data());
+			std::string uniform_name(name.data(), length);
+			GLint location = glGetUniformLocation(handle, uniform_name.c_str());
+			if (location < 0) {
+				// block members have no location
+				continue;
+			}
+			// array uniforms report "name[0]"; only the first element is cached
+			if (uniform_name.ends_with("[0]")) {
+				uniform_name.resize(uniform_name.size() - 3);
+			}
+			uniform_slots[uniform_name] = static_cast<int>(slots.size());
+			slots.push_back(UniformSlot{ location, type, cache_size });
+			cache_size += sizeof(glm::mat4);
+		}
+		value_cache.resize(cache_size);
+	}
+
+	std::unordered_map<std::string, int> uniform_slots;
+	std::vector<UniformSlot> slots;
+	std::vector<unsigned char> value_cache;
+};
+
+template<> struct ShaderProgram::UniformTraits<int> {
+	static bool accepts(GLenum type) {
+		return type == GL_INT || type == GL_BOOL || type == GL_SAMPLER_2D || type == GL_SAMPLER_CUBE;
+	}
+	static void upload(GLuint program, GLint location, const int& value) {
+		glProgramUniform1i(program, location, value);
+	}
+};
+
+template<> struct ShaderProgram::UniformTraits<float> {
+	static bool accepts(GLenum type) {
+		return type == GL_FLOAT;
+	}
+	static void upload(GLuint program, GLint location, const float& value) {
+		glProgramUniform1f(program, location, value);
+	}
+};
+
+template<> struct ShaderProgram::UniformTraits<glm::vec3> {
+	static bool accepts(GLenum type) {
+		return type == GL_FLOAT_VEC3;
+	}
+	static void upload(GLuint program, GLint location, const glm::vec3& value) {
+		glProgramUniform3fv(program, location, 1, glm::value_ptr(value));
+	}
+};
+
+template<> struct ShaderProgram::UniformTraits<glm::vec4> {
+	static bool accepts(GLenum type) {
+		return type == GL_FLOAT_VEC4;
+	}
+	static void upload(GLuint program, GLint location, const glm::vec4& value) {
+		glProgramUniform4fv(program, location, 1, glm::value_ptr(value));
+	}
+};
+
+template<> struct ShaderProgram::UniformTraits<glm::mat4> {
+	static bool accepts(GLenum type) {
+		return type == GL_FLOAT_MAT4;
+	}
+	static void upload(GLuint program, GLint location, const glm::mat4& value) {
+		glProgramUniformMatrix4fv(program, location, 1, GL_FALSE, glm::value_ptr(value));
 	}
 };
\ No newline at end of file
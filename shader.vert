@@ -2,14 +2,25 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoord;
 layout (location = 2) in vec3 aNormal;
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 project;
-uniform mat4 vp_light;
+layout (location = 3) in mat4 model; // per instance
+
+layout (std140, binding = 0) uniform PassData {
+	mat4 view;
+	mat4 project;
+	mat4 vp_light;
+	vec4 eye;
+	vec4 light_position;
+	vec4 light_color; // a = intensity
+	float zNear;
+	float zFar;
+	float lightSize;
+};
+
 out vec3 pos;
 out vec3 pos_light_space;
 out vec2 texCoord;
 out vec3 normal;
+invariant gl_Position;
 
 void main() {
 	vec4 temp_pos = model * vec4(aPos, 1.0f);
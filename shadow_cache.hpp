@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "framebuffer.hpp"
+#include "texture.hpp"
+
+// Shadow map of static casters that is only redrawn when the light camera
+// or a static caster moves. Each frame that needs a shadow pass, the cached
+// layer is copied into the real shadow map and the dynamic casters are
+// drawn on top; a scene without dynamic casters skips the pass entirely.
+struct ShadowCache {
+	ShadowCache(GLuint width, GLuint height)
+		: width(width), height(height), static_depth(static_layer.handle, width, height) {
+		static_layer.unbind();
+	}
+
+	// true when the static layer is out of date; light_vp is the light
+	// camera's view projection, static_version GLTFScene::static_version
+	bool static_dirty(const glm::mat4& light_vp, uint64_t static_version) const {
+		return !enabled || !valid || static_version != version
+			|| std::memcmp(&light_vp, &drawn_vp, sizeof(glm::mat4)) != 0;
+	}
+
+	// call after redrawing the static layer for these inputs
+	void static_drawn(const glm::mat4& light_vp, uint64_t static_version) {
+		drawn_vp = light_vp;
+		version = static_version;
+		valid = true;
+		static_draws += 1;
+	}
+
+	// copies the static layer into the depth of fbo, which must have the same
+	// size and depth format
+	void composite(GLuint fbo) {
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, static_layer.handle);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		composites += 1;
+	}
+
+	void end_frame() {
+		frames += 1;
+	}
+
+	void print_stats(std::ostream& os) const {
+		os << "shadow cache: " << (enabled ? "on" : "off") << ", static layer drawn " << static_draws
+			<< " times, composited " << composites << " times in " << frames << " frames" << std::endl;
+	}
+
+	GLuint width, height;
+	Framebuffer static_layer;
+	Texture static_depth;
+	// off redraws the static layer every frame
+	bool enabled = true;
+	uint64_t frames = 0, static_draws = 0, composites = 0;
+private:
+	glm::mat4 drawn_vp = glm::mat4(1.0f);
+	uint64_t version = 0;
+	bool valid = false;
+};
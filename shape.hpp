@@ -12,6 +12,7 @@
 #include "camera.hpp"
 #include "material.hpp"
 #include "utils.hpp"
+#include "gl_state.hpp"
 
 
 class ShapeObject { 
@@ -21,7 +22,7 @@ public:
 	ShapeObject() {
 
 	}
-	virtual void draw(const Camera &cam, std::shared_ptr<Material> material) {
+	virtual void draw(std::shared_ptr<Material> material) {
 
 	} 
 };
@@ -41,17 +42,17 @@ public:
 		glGenVertexArrays(1, &vao);
 		glGenBuffers(1, &vbo);
 
-		glBindVertexArray(vao);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		GLState::getInstance()->bind_vertex_array(vao);
+		GLState::getInstance()->bind_buffer(GL_ARRAY_BUFFER, vbo);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices[0]) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
 
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
 		glEnableVertexAttribArray(0);
 	}
 
-	void draw(const Camera& cam, std::shared_ptr<Material> material) override {
-		material->apply(model, cam);
-		glBindVertexArray(vao);
+	void draw(std::shared_ptr<Material> material) override {
+		material->apply(model);
+		GLState::getInstance()->bind_vertex_array(vao);
 		glDrawArrays(GL_TRIANGLES, 0, 3);
 	}
 };
@@ -110,11 +111,11 @@ public:
 		glGenBuffers(1, &vbo);
 		glGenBuffers(1, &ebo);
 
-		glBindVertexArray(vao);
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		GLState::getInstance()->bind_vertex_array(vao);
+		GLState::getInstance()->bind_buffer(GL_ARRAY_BUFFER, vbo);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices[0]) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+		GLState::getInstance()->bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices[0]) * indices.size(), indices.data(), GL_STATIC_DRAW);
 
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
@@ -127,11 +128,11 @@ public:
 		// glDeleteBuffers(1, &vbo);
 	}
 
-	void draw(const Camera &cam, std::shared_ptr<Material> material) override {
-		material->apply(model, cam);
+	void draw(std::shared_ptr<Material> material) override {
+		material->apply(model);
 
-		glBindVertexArray(vao);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+		GLState::getInstance()->bind_vertex_array(vao);
+		GLState::getInstance()->bind_buffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
 
 		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
 	}
@@ -1,12 +1,25 @@
 #version 430 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoord;
+layout (location = 3) in mat4 model; // per instance
 out vec2 texCoord;
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 project;
+// the depth pre-pass relies on matching depth in shader.vert
+invariant gl_Position;
+
+layout (std140, binding = 0) uniform PassData {
+	mat4 view;
+	mat4 project;
+	mat4 vp_light;
+	vec4 eye;
+	vec4 light_position;
+	vec4 light_color; // a = intensity
+	float zNear;
+	float zFar;
+	float lightSize;
+};
 
 void main() {
-	gl_Position = project * view * model * vec4(aPos, 1.0f);
+	vec4 world_pos = model * vec4(aPos, 1.0f);
+	gl_Position = project * view * world_pos;
 	texCoord = aTexCoord;
 }
\ No newline at end of file
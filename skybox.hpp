@@ -8,6 +8,7 @@
 #include "shader.hpp"
 #include "texture.hpp"
 #include "camera.hpp"
+#include "gl_state.hpp"
 
 struct SkyBox {
 
@@ -16,8 +17,8 @@ struct SkyBox {
         glGenVertexArrays(1, &vao);
         glGenBuffers(1, &vbo);
 
-        glBindVertexArray(vao);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        GLState::getInstance()->bind_vertex_array(vao);
+        GLState::getInstance()->bind_buffer(GL_ARRAY_BUFFER, vbo);
         glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), skyboxVertices, GL_STATIC_DRAW);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)(0));
         glEnableVertexAttribArray(0);
@@ -28,16 +29,11 @@ struct SkyBox {
         texture = std::make_shared<CubeMapTexture>(std::move(filenames));
     }
 
-    void draw(const Camera &cam) {
+    void draw() {
         shader_program->use();
-        GLuint location = glGetUniformLocation(shader_program->handle, "rotation");
-        glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(cam.project() * cam.view()));
-        location = glGetUniformLocation(shader_program->handle, "tex");
-        glUniform1i(location, 0);
         texture->use();
 
-        glBindVertexArray(vao);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        GLState::getInstance()->bind_vertex_array(vao);
         glDrawArrays(GL_TRIANGLES, 0, 36);
     }
 
@@ -50,12 +46,22 @@ struct SkyBox {
         layout (location = 0) in vec3 aPos;
         out vec3 texCoord;
 
-        uniform mat4 rotation;
+        layout (std140, binding = 0) uniform PassData {
+            mat4 view;
+            mat4 project;
+            mat4 vp_light;
+            vec4 eye;
+            vec4 light_position;
+            vec4 light_color; // a = intensity
+            float zNear;
+            float zFar;
+            float lightSize;
+        };
 
         void main() {
             texCoord = aPos;
             float scale = 10.0;
-            gl_Position = rotation * mat4(scale, 0.0, 0.0, 0.0, 0.0, scale, 0.0, 0.0, 0.0, 0.0, scale, 0.0, 0.0, 0.0, 0.0, 1.0) * vec4(aPos, 1.0);
+            gl_Position = project * view * mat4(scale, 0.0, 0.0, 0.0, 0.0, scale, 0.0, 0.0, 0.0, 0.0, scale, 0.0, 0.0, 0.0, 0.0, 1.0) * vec4(aPos, 1.0);
         }
     )";
 
@@ -64,7 +70,7 @@ struct SkyBox {
         in vec3 texCoord;
         out vec4 color;
 
-        uniform samplerCube tex;
+        layout (binding = 0) uniform samplerCube tex;
 
         void main() {
             color = texture(tex, texCoord);
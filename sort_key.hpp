@@ -0,0 +1,68 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+// 64-bit draw sort key, most significant field first:
+// | pass (2) | program (10) | material (12) | texture (12) | primitive (12) | lod (2) | depth (14) |
+// sorting by key groups draws by GL state, the cheapest-to-switch state lowest;
+// equal primitives at equal LODs end up adjacent and can be drawn as one
+// instanced command.
+enum SortKeyPass {
+	SKP_OPAQUE = 0,
+	SKP_BLEND = 1,
+};
+
+inline uint16_t quantize_depth(float ndc_z) {
+	float d = glm::clamp(ndc_z * 0.5f + 0.5f, 0.0f, 1.0f);
+	return static_cast<uint16_t>(d * 16383.0f);
+}
+
+inline uint64_t make_sort_key(uint32_t pass, uint32_t program, uint32_t material, uint32_t texture, uint32_t primitive, uint32_t lod, float ndc_z) {
+	uint64_t key = 0;
+	key |= (static_cast<uint64_t>(pass) & 0x3) << 62;
+	key |= (static_cast<uint64_t>(program) & 0x3ff) << 52;
+	key |= (static_cast<uint64_t>(material) & 0xfff) << 40;
+	key |= (static_cast<uint64_t>(texture) & 0xfff) << 28;
+	key |= (static_cast<uint64_t>(primitive) & 0xfff) << 16;
+	key |= (static_cast<uint64_t>(lod) & 0x3) << 14;
+	key |= quantize_depth(ndc_z);
+	return key;
+}
+
+// LSD radix sort on T::key, 8 bits per pass. Passes where every key shares the
+// same digit are skipped, so keys with mostly-constant high bits stay cheap.
+// scratch must hold n elements.
+template<typename T>
+void radix_sort_by_key(T* items, T* scratch, size_t n) {
+	if (n < 2) {
+		return;
+	}
+	T* src = items;
+	T* dst = scratch;
+
+	for (int shift = 0; shift < 64; shift += 8) {
+		size_t count[256] = {};
+		for (size_t i = 0; i < n; ++i) {
+			++count[(src[i].key >> shift) & 0xff];
+		}
+		if (count[(src[0].key >> shift) & 0xff] == n) {
+			continue;
+		}
+		size_t offset = 0;
+		for (size_t &c : count) {
+			size_t temp = c;
+			c = offset;
+			offset += temp;
+		}
+		for (size_t i = 0; i < n; ++i) {
+			dst[count[(src[i].key >> shift) & 0xff]++] = src[i];
+		}
+		std::swap(src, dst);
+	}
+
+	if (src != items) {
+		std::copy(src, src + n, items);
+	}
+}
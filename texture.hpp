@@ -5,18 +5,19 @@
 #include <glad/glad.h>
 #include <iostream>
 #include "utils.hpp"
+#include "gl_state.hpp"
 
 class Texture {
 public:
 	GLuint handle;
 
 	Texture(const char* filename) {
-		stbi_set_flip_vertically_on_load(true);
+		stbi_set_flip_vertically_on_load_thread(true);
 		int width, height, nrChannels;
 		unsigned char* data = stbi_load(filename, &width, &height, &nrChannels, 0);
 
 		glGenTextures(1, &handle);
-		glBindTexture(GL_TEXTURE_2D, handle);
+		GLState::getInstance()->bind_texture(GL_TEXTURE_2D, handle);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -28,7 +29,7 @@ public:
 
 	Texture(GLuint fbo, GLuint width, GLuint height) {
 		glGenTextures(1, &handle);
-		glBindTexture(GL_TEXTURE_2D, handle);
+		GLState::getInstance()->bind_texture(GL_TEXTURE_2D, handle);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -46,7 +47,7 @@ public:
 			int component_type = GL_UNSIGNED_BYTE, int format = GL_RGBA
 	) {
 		glGenTextures(1, &handle);
-		glBindTexture(GL_TEXTURE_2D, handle);
+		GLState::getInstance()->bind_texture(GL_TEXTURE_2D, handle);
 		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, component_type, bytes.data());
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap_s);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap_t);
@@ -55,9 +56,23 @@ public:
 		glGenerateMipmap(GL_TEXTURE_2D);
 	}
 
+	// replaces the image and its mipmaps, keeping handle and sampling state;
+	// pixels is an offset while a GL_PIXEL_UNPACK_BUFFER is bound
+	void set_image(int width, int height, const void* pixels, int component_type = GL_UNSIGNED_BYTE, int format = GL_RGBA) {
+		GLState::getInstance()->bind_texture(GL_TEXTURE_2D, handle);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, component_type, pixels);
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+
+	// one level of a prebuilt mip chain; once every level down to 1x1 is
+	// set, the texture is complete without glGenerateMipmap
+	void set_level(int level, int width, int height, const void* pixels, int component_type = GL_UNSIGNED_BYTE, int format = GL_RGBA) {
+		GLState::getInstance()->bind_texture(GL_TEXTURE_2D, handle);
+		glTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0, format, component_type, pixels);
+	}
+
 	void use(GLenum texture = GL_TEXTURE0) {
-		glActiveTexture(texture);
-		glBindTexture(GL_TEXTURE_2D, handle);
+		GLState::getInstance()->bind_texture(texture, GL_TEXTURE_2D, handle);
 	}
 };
 
@@ -67,9 +82,9 @@ public:
 
 	// right, left, up, down, back, front
 	CubeMapTexture(std::array<const char*, 6> &&filenames) {
-		stbi_set_flip_vertically_on_load(true);
+		stbi_set_flip_vertically_on_load_thread(true);
 		glGenTextures(1, &handle);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, handle);
+		GLState::getInstance()->bind_texture(GL_TEXTURE_CUBE_MAP, handle);
 
 		int width, height, nrChannels;
 		std::array<unsigned char*, 6> data;
@@ -86,7 +101,6 @@ public:
 	}
 
 	void use(GLenum texture = GL_TEXTURE0) {
-		glActiveTexture(texture);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, handle);
+		GLState::getInstance()->bind_texture(texture, GL_TEXTURE_CUBE_MAP, handle);
 	}
 };
\ No newline at end of file
@@ -0,0 +1,121 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads for fork-join work on the frame. parallel_for
+// hands out indices one at a time to the workers and the calling thread and
+// returns once all are done; it does not allocate, so it is safe to use every
+// frame. One parallel_for runs at a time.
+struct ThreadPool {
+public:
+	// worker count used by getInstance(); 0 runs everything on the caller.
+	// Defaults to one less than the hardware threads.
+	static inline int requested_workers = -1;
+
+	static ThreadPool* getInstance();
+
+	// fn(index) for every index in [0, count)
+	template<typename F>
+	void parallel_for(size_t count, F&& fn) {
+		using Fn = std::remove_reference_t<F>;
+		run(count, const_cast<void*>(static_cast<const void*>(&fn)), [](void* ctx, size_t index) {
+			(*static_cast<Fn*>(ctx))(index);
+		});
+	}
+
+	// threads taking part in parallel_for, the caller included
+	size_t concurrency() const {
+		return workers.size() + 1;
+	}
+
+private:
+	using Call = void (*)(void*, size_t);
+
+	explicit ThreadPool(size_t worker_count);
+	void run(size_t count, void* ctx, Call call);
+	void work();
+	void worker_loop();
+
+	static inline ThreadPool* instance = nullptr;
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake, finished;
+	uint64_t generation = 0;
+	size_t active_workers = 0;
+
+	void* job_ctx = nullptr;
+	Call job_call = nullptr;
+	size_t job_count = 0;
+	std::atomic<size_t> next_index{ 0 };
+};
+
+ThreadPool* ThreadPool::getInstance() {
+	if (instance == nullptr) {
+		size_t worker_count = requested_workers >= 0
+			? static_cast<size_t>(requested_workers)
+			: std::max(1u, std::thread::hardware_concurrency()) - 1;
+		instance = new ThreadPool(worker_count);
+	}
+	return instance;
+}
+
+ThreadPool::ThreadPool(size_t worker_count) {
+	workers.reserve(worker_count);
+	for (size_t i = 0; i < worker_count; ++i) {
+		workers.emplace_back([this] { worker_loop(); });
+	}
+}
+
+void ThreadPool::work() {
+	for (size_t i = next_index.fetch_add(1); i < job_count; i = next_index.fetch_add(1)) {
+		job_call(job_ctx, i);
+	}
+}
+
+void ThreadPool::worker_loop() {
+	uint64_t seen = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return generation != seen; });
+			seen = generation;
+		}
+		work();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			active_workers -= 1;
+		}
+		finished.notify_one();
+	}
+}
+
+void ThreadPool::run(size_t count, void* ctx, Call call) {
+	if (count == 0) {
+		return;
+	}
+	if (workers.empty() || count == 1) {
+		for (size_t i = 0; i < count; ++i) {
+			call(ctx, i);
+		}
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job_ctx = ctx;
+		job_call = call;
+		job_count = count;
+		next_index = 0;
+		active_workers = workers.size();
+		generation += 1;
+	}
+	wake.notify_all();
+	work();
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [&] { return active_workers == 0; });
+}
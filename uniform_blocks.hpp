@@ -0,0 +1,120 @@
+#pragma once
+#include <cstring>
+#include <stdexcept>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "camera.hpp"
+#include "light.hpp"
+#include "gl_state.hpp"
+
+// Uniform blocks shared by all programs, see the PassData and MaterialData
+// blocks in the shaders. The C++ structs mirror the std140 layout.
+enum UniformBlockBinding {
+	UBB_PASS = 0,
+	UBB_MATERIALS = 1,
+};
+
+// camera and light data, written once per pass
+struct PassData {
+	glm::mat4 view;
+	glm::mat4 project;
+	glm::mat4 vp_light;
+	glm::vec4 eye;
+	glm::vec4 light_position;
+	glm::vec4 light_color; // a = intensity
+	float z_near; // light camera
+	float z_far;
+	float light_size;
+	float _pad;
+};
+static_assert(sizeof(PassData) == 256, "PassData must match the std140 PassData block");
+
+struct PassUniformBuffer {
+	GLuint handle;
+
+	PassUniformBuffer() {
+		glGenBuffers(1, &handle);
+		GLState::getInstance()->bind_buffer(GL_UNIFORM_BUFFER, handle);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(PassData), nullptr, GL_DYNAMIC_DRAW);
+		GLState::getInstance()->bind_buffer_base(GL_UNIFORM_BUFFER, UBB_PASS, handle);
+	}
+
+	void update(const Camera& cam, const PointLight& light) {
+		PassData data{
+			.view = cam.view(),
+			.project = cam.project(),
+			.vp_light = light.light_cam.project() * light.light_cam.view(),
+			.eye = glm::vec4(cam.pos, 1.0f),
+			.light_position = glm::vec4(light.position, 1.0f),
+			.light_color = glm::vec4(light.color, light.intensity),
+			.z_near = light.light_cam.zNear,
+			.z_far = light.light_cam.zFar,
+			.light_size = light.size,
+			._pad = .0f,
+		};
+		if (valid && std::memcmp(&data, &current, sizeof(PassData)) == 0) {
+			return;
+		}
+		current = data;
+		valid = true;
+		GLState::getInstance()->bind_buffer(GL_UNIFORM_BUFFER, handle);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(PassData), &current);
+	}
+
+private:
+	PassData current;
+	bool valid = false;
+};
+
+// per-material constants, indexed by Material::table_index in the shaders
+struct MaterialData {
+	float k_ambient;
+	float k_diffuse;
+	float k_specular;
+	float phong_exponent;
+	int recv_shadow;
+	int _pad[3];
+};
+static_assert(sizeof(MaterialData) == 32, "MaterialData must match the std140 MaterialData block");
+
+struct MaterialTable {
+public:
+	static constexpr uint32_t MAX_MATERIALS = 256;
+
+	static MaterialTable* getInstance();
+	uint32_t add(const MaterialData& data);
+	void set(uint32_t index, const MaterialData& data);
+private:
+	explicit MaterialTable();
+	static inline MaterialTable* instance = nullptr;
+	GLuint handle;
+	uint32_t count = 0;
+};
+
+MaterialTable* MaterialTable::getInstance() {
+	if (instance == nullptr) {
+		instance = new MaterialTable();
+	}
+	return instance;
+}
+
+MaterialTable::MaterialTable() {
+	glGenBuffers(1, &handle);
+	GLState::getInstance()->bind_buffer(GL_UNIFORM_BUFFER, handle);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(MaterialData) * MAX_MATERIALS, nullptr, GL_STATIC_DRAW);
+	GLState::getInstance()->bind_buffer_base(GL_UNIFORM_BUFFER, UBB_MATERIALS, handle);
+}
+
+uint32_t MaterialTable::add(const MaterialData& data) {
+	if (count >= MAX_MATERIALS) {
+		throw std::runtime_error("material table is full");
+	}
+	set(count, data);
+	return count++;
+}
+
+void MaterialTable::set(uint32_t index, const MaterialData& data) {
+	GLState::getInstance()->bind_buffer(GL_UNIFORM_BUFFER, handle);
+	glBufferSubData(GL_UNIFORM_BUFFER, sizeof(MaterialData) * index, sizeof(MaterialData), &data);
+}